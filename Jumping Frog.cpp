@@ -2,7 +2,29 @@
 #include <iostream>
 #include <curses.h>
 #include <cstdlib>
+#include <cstring>
 #include <time.h>
+#include <errno.h>
+#include <atomic>
+#include <thread>
+#include <algorithm>
+#include <climits>
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <mutex>
+#include <condition_variable>
+#include <new>
+#include <cstdarg>
+#include <csignal>
+#include <termios.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define CAR_KERNELS_X86                 // SSE2 and AVX2 car kernels, picked at run time
+#endif
 
 using namespace std;
 
@@ -26,20 +48,27 @@ using namespace std;
 #define COIN_SIGN '*'
 #define OBSTACLE_COUNT 30
 #define OBSTACLE_SIGN 'X'
+#define MAP_CHANGE_LOG 8                // Cells changed during play the map remembers (spectator feed)
 
 // STATS SETUP
 #define STATS_WIDTH 20
-#define STATS_HEIGHT 9
+#define STATS_HEIGHT 13
 
 // STORK_SETUP
 #define STORK_SIGN 'S'
 #define TIME_TO_STORK 5
+#define STORKS_COUNT 1
+#define STORK_MOVE_INTERVAL 2000        // Game time in ms
 
 // FROG SETUP
 #define FROG_REMAINING_MOVES 5
+#define FROG_MOVE_INTERVAL 200          // Game time in ms
 
 // CAR SETUP
 #define CAR_MAX_DISTANCE_FROM_FROG 2
+#define CAR_ALWAYS_MOVE 1           // Flag of the red (enemy) cars
+#define CAR_WAITING 2               // Flag of the cars waiting behind the entry of a full lane
+#define CARS_PER_LANE 1
 
 
 // POSITION TYPES
@@ -54,7 +83,100 @@ using namespace std;
 #define CHECK_FRAME_RATE 0
 #define FRAME_RATE 100
 #define MAX_FRAME_RATE 1000
-
+#define MAX_CATCH_UP_TICKS 5            // Ticks run back to back after a stall, the rest is dropped
+
+// ENDLESS SETUP
+#define ENDLESS_CHUNK_ROWS 8            // Rows generated at once above the viewport
+#define ENDLESS_START_ROWS 2            // Grass rows at the bottom of the first chunk (frog start)
+
+// ROUND STATES
+#define ROUND_RUNNING 0
+#define ROUND_CAR_HIT 1
+#define ROUND_STORK_HIT 2
+#define ROUND_WON 3
+
+// ARENA SETUP
+#define ARENA_ALIGN 16                  // Every allocation starts on this boundary
+#define ARENA_MIN_BLOCK 4096
+
+// HEADLESS SETUP
+#define SCRIPT_MAX_EVENTS 100000
+
+// INPUT SETUP
+#define KEY_QUEUE_SIZE 256              // Keys the reader can be ahead of the game (power of two)
+#define KEY_POLL_MS 50                  // How often the reader checks whether the round is over
+#define INPUT_BUFFER 1                  // Moves kept while the frog waits between moves
+#define INPUT_MAX_BUFFER 8
+
+// BATCH SETUP
+#define BATCH_ROUND_TICKS 6000          // Rounds still running after this many ticks count as unfinished
+#define BATCH_MAX_SWEEPS 8
+#define BATCH_MAX_VALUES 16
+#define POLICY_SEED 0xA5A5A5A5A5A5A5A5ULL     // Random policy stream, apart from the round's own
+
+// PROFILER SETUP
+#define PHASE_COLLISION 0               // Parts of a frame that are timed
+#define PHASE_WIN 1
+#define PHASE_FROG 2
+#define PHASE_CARS 3
+#define PHASE_STORKS 4
+#define PHASE_STATS 5
+#define PHASE_FLUSH 6
+#define PROFILE_PHASES 7
+#define PROFILE_SUB_BITS 4              // Buckets per power of two as bits, so values are kept within 1/16
+#define PROFILE_BUCKETS ((48 - PROFILE_SUB_BITS + 1) << PROFILE_SUB_BITS)      // Up to 2^48 ns
+#define PROFILE_WINDOW_FRAMES 50        // Rolling figures cover the last one or two windows
+
+// LEADERBOARD SETUP
+#define LEADERBOARD_FILE "leaderboard.log"
+#define LEADERBOARD_SIZE 10             // Best rounds kept per config (plus the best round of every seed)
+#define LEADERBOARD_MAX_SCORES 1000     // Rounds kept in all, the oldest seed bests outside the tops go first
+#define LEADERBOARD_SLACK 64            // Records the log may hold beyond twice the index before it is compacted
+#define BOARD_KEY_SIZE 48
+
+// BENCH SUITE SETUP (built with -DBENCH_SUITE)
+#define BENCH_SEED 1                    // Without --seed, so runs compare against a baseline on the same rounds
+#define BENCH_SAMPLE_NS 20000000        // Each sample runs a kernel at least this long
+#define BENCH_SAMPLES 5                 // The median is reported
+#define BENCH_THRESHOLD 10              // Percent slower than the baseline that counts as a regression
+
+// RENDER SETUP
+#define RENDER_COLOR_MASK 0xFF          // Color pair in the low bits of a style, attributes above
+#define RENDER_REVERSE 0x100            // Reverse video (menu highlight)
+#define RENDER_LINE 0x200               // Line drawing character (borders)
+#define ANSI_DEFAULT_ROWS 24            // Terminal size when the terminal does not tell
+#define ANSI_DEFAULT_COLS 80
+#define RENDER_SLOW_NS 2000000          // A flush longer than this means the terminal is backed up (2 ms)
+#define RENDER_BACKOFF 2                // After a slow flush the next waits that many times as long
+
+// SPECTATOR SETUP
+#define SPECTATOR_MAGIC "JFSPEC1"       // Written last, once the segment is ready
+#define SPECTATOR_SLOTS 64              // Snapshots in the ring (power of two), older ones are overwritten
+#define SPECTATOR_MAX_CHANGES 8         // Changed cells listed per snapshot, beyond that readers read the board again
+#define SPECTATOR_ALIGN 64              // Board and slots start on their own cache lines
+#define SPECTATOR_ATTACH_MS 5000        // How long --watch waits for the game to start publishing
+#define SPECTATOR_POLL_US 1000          // How often --watch looks for a new snapshot
+
+// SAVE STATE SETUP
+#define STATE_MAGIC "JFS1"
+#define REWIND_SECONDS 30               // Game time practice mode can go back
+#define REWIND_KEYFRAME_TICKS 50        // A keyframe every this many ticks, deltas from the tick before in between
+#define REWIND_STEP_TICKS 50            // Ticks one press of R goes back
+#define REWIND_MAX_GROUPS 32            // Keyframes (with their deltas) kept, the window plus the one being filled
+#define REWIND_POLL_MS 10               // How often a lost practice round looks for R
+
+// REPLAY SETUP
+#define REPLAY_MAGIC "JFR6"
+#define REPLAY_KEY_BITS 3               // Key code in the low bits of each event, tick delta above
+#define REPLAY_HASH_CODE 7              // Event of a state hash, its 8 bytes follow
+
+// STATE HASH SETUP
+#define HASH_CELL 1                     // Kinds of Zobrist keys (HashKey): a map cell
+#define HASH_CAR_PLACE 2                // where a car is
+#define HASH_CAR 3                      // the rest of a car
+#define HASH_FROG 4
+#define HASH_STORK 5
+#define HASH_CLOCK 6                    // timers, scroll and the random state
 
 
 
@@ -62,24 +184,112 @@ using namespace std;
 //----------------  DATA STRUCTURES --------------
 //------------------------------------------------
 
+struct ARENA {                  // Memory of one round: taken by moving an offset, given back all at once
+    char* block;
+    size_t capacity;
+    size_t used;
+    char** overflow;            // Heap blocks of the allocations that didn't fit, freed on reset
+    int overflowCount;
+    int overflowCapacity;
+    size_t overflowBytes;
+    size_t peak;                // Most bytes held since the last reset, the block grows to it
+    long long allocations;      // Since the last reset
+    long long heapBlocks;       // Taken from the heap (all time), stays put once a round fits in the block
+};
+
+struct WIN;
+
+struct ANSI_SCREEN {            // Double buffer of the ANSI renderer
+    int rows, cols;             // Terminal size
+    unsigned* back;             // Cells the windows drew (char | style << 8)
+    unsigned* front;            // Cells the terminal shows
+    int* dirtyFrom;             // Columns of each row drawn since the last update (from > to: none)
+    int* dirtyTo;
+    char* out;                  // Bytes of one update, sent with a single write()
+    int outLength;
+    int outCapacity;
+    int outSent;                // Of them already written (less while the terminal is backed up)
+    int outFlags;               // File status flags of the terminal, O_NONBLOCK only set for a write
+    long long sentBytes;        // Everything written to the terminal
+    long long sentWrites;       // in that many write() calls
+    int cursorRow, cursorCol;   // Where the terminal's cursor is (-1: not known)
+    int style;                  // Colors and attributes the terminal writes with
+    termios saved;              // Terminal modes given back at the end
+};
+
+struct RENDERER {               // Where the windows draw: curses, ANSI sequences of what changed, or nowhere
+    const char* name;
+    bool draws;                 // false for the null renderer, so callers skip the work of drawing
+    bool (*start)(RENDERER* renderer);
+    void (*end)(RENDERER* renderer);
+    void (*open)(WIN* w);                                           // Window placed on the screen
+    void (*close)(WIN* w);
+    void (*put)(WIN* w, int row, int col, char ch, int style);      // Style: color pair and RENDER_ attributes
+    void (*print)(WIN* w, int row, int col, int style, const char* text);      // Style 0: the window's color
+    void (*erase)(WIN* w);
+    void (*outline)(WIN* w);                                        // Box along the window's edge
+    void (*stage)(WIN* w);                                          // Changes of the window go into the next update
+    void (*update)(RENDERER* renderer);                             // Everything staged reaches the terminal at once
+    bool (*backedUp)(RENDERER* renderer);                           // The last update is not out yet, better skip a frame
+    bool (*sent)(RENDERER* renderer, long long* bytes, long long* writes);     // Terminal output so far (false: not known)
+    int (*readKey)(WIN* w);                                         // Waits for a key (menu and result screen)
+    void (*dropKeys)(RENDERER* renderer);                           // Keys typed ahead don't count
+    int rows, cols;             // Terminal size, once started
+    long long frameNs;          // Shortest time from one game frame to the next (--max-fps, 0: every tick)
+    WINDOW* screen;             // curses: the main window
+    ANSI_SCREEN* ansi;          // ANSI: the double buffer
+};
+
 struct WIN {
-    WINDOW* window;
+    RENDERER* renderer;         // The null renderer for headless windows
+    WINDOW* window;             // curses only
     int x, y;
     int width, height;
     int color;
+    int scrollY;                // World row shown on the first screen row (0 unless the board scrolls)
 };
 
-struct CAR {
-    WIN* win;
-    int x;
-    int y;
-    int length;
-    int direction;
-    int color;
-    int speed;
-    int xSpeedChange;
-    int alwaysMove;
+struct CARS {                   // One array per car field, indexed by car
+    int count;
+    int capacity;
+    int* x;
+    int* y;
+    int* length;
+    int* direction;
+    int* speed;
+    int* xSpeedChange;
+    unsigned char* flags;       // CAR_ALWAYS_MOVE
+    unsigned char* color;
+    int maxSpeed;
+    unsigned char* dueBySpeed;  // Per tick: 1 if cars of that speed move (replaces a division per car)
+    int* dueSpeeds;             // Per tick: the speeds that move
+    bool dense;                 // Lanes of one car: moving cars found by the car kernels instead of the timing wheel
     char sign;
+    int* wheelHead;             // Timing wheel: first car of every slot, a slot per tick (-1 if none)
+    int* wheelNext;             // Per car: links of the slot it waits in
+    int* wheelPrev;
+    int* wheelSlot;             // Per car: slot of its next move (-1 if not waiting)
+    int wheelMask;              // Slots - 1, slots are a power of two above the longest wait
+    long long wheelTick;        // MoveCars calls so far
+    int* waitBySpeed;           // Per tick: ticks until cars of that speed move again
+    unsigned long long* touch;  // Bit per car visited next tick whether it moves or not (speed change cell, redraw)
+    unsigned long long* visit;  // Bit per car visited this tick
+    unsigned long long* shift;  // Bit per car that only moves one cell this tick (dense)
+    int words;                  // 64-bit words of touch and visit
+    unsigned long long hash;    // Zobrist hash of the cars, kept up as they change (CarKey)
+};
+
+struct MAP {
+    int rows;
+    int cols;
+    int stride;                 // Cells from the start of one row to the next
+    unsigned char* cells;       // Position types, row after row in one block
+    int top;                    // World row held in ring row head (rows are a ring, see RingRow)
+    int head;
+    long long changes;          // Cells changed during play (coins taken), the last ones in changeY and changeX
+    int changeY[MAP_CHANGE_LOG];
+    int changeX[MAP_CHANGE_LOG];
+    unsigned long long hash;    // Zobrist hash of the cells the ring holds, kept up as they change (CellKey)
 };
 
 struct FROG {
@@ -92,8 +302,10 @@ struct FROG {
     int color;
     char sign;
     bool carried;
-    clock_t lastMoveTime;
-    CAR* carringCar;
+    int lastMoveTime;
+    int carringCar;         // Index of the car carrying the frog (-1 if none)
+    int startY;
+    int distance;           // Most rows advanced from the start
 };
 
 struct STORK {
@@ -103,11 +315,41 @@ struct STORK {
     int color;
     char sign;
     int timeToStork;
-    clock_t lastMoveTime;
+};
+
+struct FLOWFIELD {              // Steps from every viewport cell to the frog, one search shared by all storks
+    int rows;
+    int cols;
+    int words;                  // 64-bit words per row
+    unsigned long long* open;   // Cells storks can walk on, one bitset per row (copied from the map when it changes)
+    unsigned long long* found;  // Cells the current search reached
+    unsigned long long* front;  // Cells reached by the last level of the search
+    unsigned long long* next;
+    unsigned long long* spread; // One row of the front and its neighbour rows merged
+    int* distance;
+    unsigned int* stamp;        // distance is known where stamp == generation
+    unsigned int generation;
+    int level;                  // Distance of the front
+    int frontTop;               // Rows the front spans
+    int frontBottom;
+    bool done;                  // Nothing left to reach
+    int frogX;                  // What the field was built for
+    int frogY;
+    int scrollY;
+    bool dirty;                 // Set when the map changes
+    long long builds;           // Searches started (one per frog move at most, whatever the number of storks)
+};
+
+struct STORKS {
+    int count;
+    STORK* stork;
+    FLOWFIELD* field;
+    int lastMoveTime;           // All storks move together
 };
 
 struct TIMER {
     int time;
+    int elapsed;            // Game time in ms (frameRate per tick)
     int carsTiming;
     int carsTime;
     int frameRate;
@@ -115,850 +357,6364 @@ struct TIMER {
     int checkFrameRate;
 };
 
+struct OCCUPANCY {
+    int rows;
+    int padding;                // Columns kept on both sides of the board (cars and a carried frog leave the board before reset)
+    int width;                  // Board columns plus padding
+    int words;                  // 64-bit words per row
+    unsigned long long* bits;   // One bitset per row, bit set where a car is
+    CARS* cars;
+    int perLane;                // Cars a lane can hold
+    int* lane;                  // Per row: its cars from the front to the back, a ring of perLane slots from laneHead
+    int* laneHead;
+    int* laneCount;             // Cars of the row, on the board or waiting
+    int* laneWaiting;           // The last ones of the ring wait to enter (CAR_WAITING)
+    int* carSlot;               // Per car: its slot in the lane
+    int top;                    // Same ring as the map
+    int head;
+};
+
+struct SCHEDULER {
+    long long tickNs;           // Fixed timestep
+    long long nextTick;         // Deadline of the next tick (CLOCK_MONOTONIC, ns)
+    int maxCatchUp;
+    long long ticks;
+    long long droppedTicks;
+    long long lastJitter;       // How late the last tick started (ns)
+};
+
+struct FRAME {                  // Frame composer, at most one terminal flush per tick
+    long long lastBytes;        // Written to the terminal by the last flush (-1: the renderer can't tell)
+    long long lastWrites;       // write() calls of the last flush
+    long long lastFlushNs;      // How long the last flush took
+    long long nextNs;           // No flush before this (CLOCK_MONOTONIC): --max-fps, or backing off a slow terminal
+    long long rendered;         // Frames flushed this round
+    long long skipped;          // Frames merged into a later one
+};
+
+struct STATS {                  // Values on screen, so only changed fields are repainted
+    bool drawn;
+    int time;
+    int moves;
+    int points;
+    int jitter;                 // 0.1 ms units
+    long long bytes;
+    long long writes;
+    int latency;                // 0.1 ms units
+    long long skipped;
+};
+
+struct RNG {
+    unsigned long long state;
+};
+
+struct HISTOGRAM {              // Log-linear buckets (HDR style), fixed size so adding a sample never allocates
+    long long count;
+    long long sum;
+    long long max;
+    unsigned int buckets[PROFILE_BUCKETS];
+};
+
+struct PROFILER {
+    HISTOGRAM round[PROFILE_PHASES];            // Whole round, written to the dump
+    HISTOGRAM window[2][PROFILE_PHASES];        // Rolling figures: the window being filled and the one before
+    int current;
+    int frames;
+    bool overlay;               // Figures in the stats window
+    const char* dump;           // Round histograms are appended here (NULL = no file)
+    bool drawn;
+    char shown[PROFILE_PHASES][STATS_WIDTH];    // Overlay rows on screen
+    long long heapStart;        // heapAllocations when the round started
+    long long heapAllocations;  // Made by any thread up to the last whole frame (0 once the round is set up)
+};
+
+struct KEY_EVENT {
+    int key;
+    long long ns;               // When the reader got it (CLOCK_MONOTONIC)
+};
+
+struct KEY_QUEUE {              // Reader thread to game loop, one writer and one reader, no locks
+    KEY_EVENT events[KEY_QUEUE_SIZE];
+    std::atomic<unsigned> head; // Next event to read (game loop)
+    std::atomic<unsigned> tail; // Next free slot (reader thread)
+    std::atomic<bool> running;
+    std::atomic<long long> dropped;     // Keys lost to a full queue
+    std::atomic<int> rewinds;           // R presses the game has not handled yet (practice mode)
+    int fd;
+    std::thread reader;
+};
+
+struct INPUT {
+    KEY_QUEUE* keys;        // Keyboard source (NULL for scripted input)
+    long long tickEndNs;    // Keys read before this belong to the current tick
+    int bufferSize;         // Moves kept while the frog waits between moves
+    KEY_EVENT pending[INPUT_MAX_BUFFER + 1];    // Keys of this and past ticks not used yet
+    int pendingCount;
+    long long shownNs;      // Read time of the last key used, until its frame is on screen
+    long long lastLatency;  // Key to screen (ns)
+    long long maxLatency;
+    long long latencySum;
+    long long latencyCount;
+    int* scriptTicks;
+    int* scriptKeys;
+    int scriptCount;
+    int scriptPos;
+    int tick;
+    int* hashTicks;         // State hashes of a replay, checked as it plays
+    unsigned long long* hashes;
+    int hashCount;
+    int hashPos;
+    int hashesChecked;
+    int desyncTick;         // First tick whose state differs from the replay's (-1 if none)
+    FILE* record;           // Replay being written (NULL if not recording)
+    int recordTick;         // Tick of the last recorded event
+    bool randomPolicy;      // Random keys instead of a script (batch runs)
+    RNG policyRng;
+};
+
+struct CONFIG {
+    int rows;
+    int cols;
+    int carsAndRoads;
+    int carSpeed;
+    int carLength;
+    char frogSign;
+    char carSign;
+    int timeToStork;        // Seconds before the stork starts
+    int frogMoves;          // Moves the frog can store
+    int storks;
+    int carsPerLane;
+    bool endless;           // Scrolling board without a destination
+};
+
+struct SCORE {
+    char board[BOARD_KEY_SIZE];     // Config the round was played on (BoardKey)
+    unsigned long long seed;
+    int points;
+    int time;
+    long long order;                // Position in the log, older first among equal rounds
+    bool keep;                      // Best round of its seed
+};
+
+struct LEADERBOARD {
+    const char* path;
+    SCORE* scores;                  // Index: the best rounds of every config and the best round of every seed
+    int count;
+    int capacity;
+    long long logRecords;           // Records in the file (stale ones too)
+    long long nextOrder;
+    std::thread writer;             // Owns the file, the game thread never waits for the disk
+    std::mutex lock;                // Guards the queue below
+    std::condition_variable wake;
+    SCORE* appends;                 // Records to append
+    int appendCount;
+    int appendCapacity;
+    SCORE* snapshot;                // Index to rewrite the log to (NULL if none queued)
+    int snapshotCount;
+    int snapshotAppends;            // Queued records the snapshot holds, appended after all if the rewrite fails
+    bool stop;
+};
+
+struct SPECTATOR_HEADER {       // Start of the shared segment, then the board, then the ring of snapshots
+    char magic[8];
+    int slotBytes;              // Fixed size of a snapshot slot
+    int carCapacity;            // Cars, storks and changed cells a slot holds
+    int storkCapacity;
+    int boardRows;              // Map of the round (a ring of rows in endless rounds, as MAP)
+    int boardCols;
+    int viewRows;               // Viewport of the game window
+    int viewCols;
+    long long boardOffset;      // From the start of the segment
+    long long slotsOffset;
+    atomic<unsigned long long> published;  // Snapshots written so far, the newest in slot (published - 1) % SPECTATOR_SLOTS
+    atomic<unsigned> boardSequence;         // Seqlock of the board and the fields below: odd while they change
+    int boardTop;               // MAP top and head of the board
+    int boardHead;
+    int round;                  // Round the board belongs to
+    char frogSign;              // Signs of the config
+    char carSign;
+    atomic<int> closed;         // Set when the game stops publishing
+};
+
+struct SPECTATOR_CAR {
+    int x;
+    int y;
+    short length;
+    signed char direction;
+    unsigned char color;
+};
+
+struct SPECTATOR_STORK {
+    int x;
+    int y;
+};
+
+struct SPECTATOR_CELL {         // Cell changed during play, with its new position type
+    int y;
+    short x;
+    unsigned char type;
+};
+
+struct SPECTATOR_SNAPSHOT {     // Slot of the ring, followed by its cars, storks and changed cells
+    atomic<unsigned> sequence;  // Seqlock: odd while the game writes the slot
+    int round;
+    unsigned long long index;   // Snapshot the slot holds
+    unsigned long long seed;
+    long long tick;
+    int state;                  // ROUND_* at the end of the tick
+    int time;                   // TIMER values
+    int elapsed;
+    int carsTime;
+    int carsTiming;
+    int frogX;
+    int frogY;
+    int frogMoves;
+    int frogPoints;
+    int frogDistance;
+    int frogCarried;
+    int scrollY;
+    int carCount;
+    int storkCount;             // 0 until the storks are out
+    int changeCount;            // -1: more than SPECTATOR_MAX_CHANGES or a new chunk, read the board again
+};
+
+struct SPECTATOR {              // Game side of the feed
+    char name[64];              // POSIX shared memory name ("/...")
+    size_t bytes;
+    unsigned char* base;        // NULL until the first round sizes the segment
+    SPECTATOR_HEADER* header;
+    unsigned char* board;
+    long long mapChanges;       // Changes of the map already on the board
+    int mapTop;
+    bool failed;                // The segment could not be made, the game goes on without the feed
+};
+
+struct STATE_HEADER {           // Start of a saved state: the round it belongs to and its tick
+    char magic[4];
+    unsigned int bytes;         // Whole state, header included (a multiple of 8)
+    unsigned long long seed;
+    long long tick;
+    int rows;                   // Config of the round, so a state file can rebuild it
+    int cols;
+    int carsAndRoads;
+    int carSpeed;
+    int carLength;
+    int timeToStork;
+    int frogMoves;
+    int storks;
+    int carsPerLane;
+    char endless;
+    char frogSign;
+    char carSign;
+};
+
+struct STATE_CURSOR {           // Walks the fields of a round, copying them to or from a state
+    unsigned char* at;          // NULL to only count the bytes
+    size_t bytes;
+    bool load;
+};
+
+struct REWIND_GROUP {           // A keyframe and the deltas of the ticks after it
+    long long tick;             // Tick of the keyframe
+    int ticks;                  // Keyframe included
+    unsigned char* data;        // Per tick: the encoded length (4 bytes), then the encoded state
+    size_t bytes;
+    size_t capacity;
+};
+
+struct REWIND {                 // The last REWIND_SECONDS of a practice round
+    size_t stateBytes;
+    unsigned long long* start;  // State the round started from, keyframes are taken against it (the map barely changes)
+    unsigned long long* last;   // State of the newest tick, the next delta is taken against it
+    unsigned long long* next;
+    unsigned char* encoded;     // Room for the largest encoding of one state
+    int keyframeTicks;
+    int slots;                  // Groups in the ring
+    int groupCount;
+    int newest;
+    REWIND_GROUP groups[REWIND_MAX_GROUPS];
+    long long keyframes;        // Encoded so far, with their bytes
+    long long keyframeBytes;
+    long long deltas;
+    long long deltaBytes;
+};
+
+struct GAME {
+    WIN* playwin;
+    WIN* statwin;
+    FROG* frog;
+    STORKS* storks;
+    TIMER* timer;
+    CARS* cars;
+    MAP* map;
+    int* roadPositions;
+    OCCUPANCY* occupancy;
+    ARENA* arena;               // Holds everything above, reset by CleanupRound
+    STATS stats;
+    FRAME frame;
+    RNG rng;
+    unsigned long long seed;
+    CONFIG config;
+    PROFILER* profiler;         // NULL unless profiling
+    LEADERBOARD* leaderboard;   // NULL outside the interactive game
+    SPECTATOR* spectator;       // NULL unless --spectate
+};
+
+struct OPTIONS {
+    bool headless;
+    long long ticks;
+    long long rounds;           // 0 = no limit
+    bool seeded;
+    unsigned long long seed;
+    const char* script;
+    const char* config;
+    const char* record;
+    const char* replay;
+    bool endless;
+    bool benchGeneration;
+    long long batch;            // Rounds per config of a batch run (0 = no batch run)
+    int threads;                // 0 = one per core
+    const char* policy;
+    const char* csv;
+    const char* sweeps[BATCH_MAX_SWEEPS];      // "name=v1,v2,..."
+    int sweepCount;
+    long long roundTicks;
+    bool autopilot;
+    int inputBuffer;
+    const char* profile;        // Dump file of the profiler
+    bool profileOverlay;
+    const char* json;           // Bench suite results (stdout if NULL)
+    const char* baseline;       // Bench suite results to compare with
+    int threshold;
+    const char* kernels;        // Car kernels to use (NULL = the widest the CPU runs)
+    int checkKernels;           // Seeds of the kernel self-check (0 = no check)
+    const char* renderer;       // Renderer of the interactive game and of --watch
+    int maxFps;                 // Frames per second at most (0 = one per tick)
+    const char* spectate;       // Shared memory name the rounds are published to
+    const char* watch;          // Shared memory name to watch
+    bool practice;              // Rounds can be rewound (R), nothing goes to the leaderboard
+    const char* saveState;      // Headless: file the last round's final state is written to
+    const char* loadState;      // Headless: state file the run resumes from
+    unsigned char* state;       // Read from loadState, the first round starts from it
+    int checkState;             // Seeds of the save state self-check (0 = no check)
+};
+
 //------------------------------------------------
-//----------------  WINDOW FUNCTIONS -------------
+//---------------  RENDERER FUNCTIONS ------------
 //------------------------------------------------
 
-WINDOW* Start() {
-    WINDOW* mainwin;
-    if ((mainwin = initscr()) == NULL) {
-        cerr << "Error initialising ncurses." << endl;      // Init ncurses
-        exit(EXIT_FAILURE);
+struct PAIR_COLORS {
+    short foreground, background;       // -1: the terminal's default
+};
+
+const PAIR_COLORS PAIRS[] = {           // Indexed by color pair, shared by every renderer
+    { -1, -1 },                         // 0: the terminal's colors (menu)
+    { COLOR_WHITE, COLOR_BLACK },       // MAIN_COLOR
+    { COLOR_GREEN, COLOR_BLACK },       // FROG_COLOR
+    { COLOR_BLACK, COLOR_GREEN },       // GRASS_COLOR
+    { COLOR_BLACK, COLOR_YELLOW },      // DESTINATION_COLOR
+    { COLOR_BLACK, COLOR_WHITE },       // ROAD_COLOR
+    { COLOR_RED, COLOR_WHITE },         // CARM_COLOR
+    { COLOR_BLUE, COLOR_WHITE },        // CARS_COLOR
+    { COLOR_YELLOW, COLOR_WHITE },      // CARC_COLOR
+    { COLOR_RED, COLOR_GREEN },         // OBSTACLE_COLOR
+    { COLOR_YELLOW, COLOR_GREEN },      // COIN_COLOR
+    { COLOR_CYAN, COLOR_BLACK }         // STORK_COLOR
+};
+#define PAIR_COUNT 12
+
+//--------------  CURSES RENDERER -------------
+
+attr_t CursesAttributes(int style) {
+    attr_t attributes = COLOR_PAIR(style & RENDER_COLOR_MASK);
+    if (style & RENDER_REVERSE) attributes |= A_REVERSE;
+    if (style & RENDER_LINE) attributes |= A_ALTCHARSET;
+    return attributes;
+}
+
+bool OutputBackedUp() {
+    pollfd poller = { STDOUT_FILENO, POLLOUT, 0 };
+    if (poll(&poller, 1, 0) == 1 && (poller.revents & POLLOUT) == 0) {
+        return true;                    // A pseudo terminal whose reader fell behind (its buffer is full)
+    }
+    int queued = 0;
+    return ioctl(STDOUT_FILENO, TIOCOUTQ, &queued) == 0 && queued > 0;        // A serial line still sending
+}
+
+bool CursesStart(RENDERER* renderer) {
+    if ((renderer->screen = initscr()) == NULL) {
+        return false;
     }
 
     start_color();                                      // Init colors
-    init_pair(MAIN_COLOR, COLOR_WHITE, COLOR_BLACK);
-    init_pair(FROG_COLOR, COLOR_GREEN, COLOR_BLACK);
-    init_pair(CARM_COLOR, COLOR_RED, COLOR_WHITE);
-    init_pair(CARS_COLOR, COLOR_BLUE, COLOR_WHITE);
-    init_pair(CARC_COLOR, COLOR_YELLOW, COLOR_WHITE);
-    init_pair(GRASS_COLOR, COLOR_BLACK, COLOR_GREEN);
-    init_pair(DESTINATION_COLOR, COLOR_BLACK, COLOR_YELLOW);
-    init_pair(ROAD_COLOR, COLOR_BLACK, COLOR_WHITE);
-    init_pair(OBSTACLE_COLOR, COLOR_RED, COLOR_GREEN);
-    init_pair(COIN_COLOR, COLOR_YELLOW, COLOR_GREEN);
-    init_pair(STORK_COLOR, COLOR_CYAN, COLOR_BLACK);
+    for (int pair = 1; pair < PAIR_COUNT; pair++) {
+        init_pair(pair, PAIRS[pair].foreground, PAIRS[pair].background);
+    }
 
     noecho();
+    cbreak();           // Keys reach the input reader one by one, not a line at a time
+    typeahead(-1);      // and waiting keys do not interrupt a frame half way
     curs_set(0);
-    return mainwin;
+    endwin();           // ncurses flushes after every cursor move until curses mode is re-entered once,
+    refresh();          // so leave and come back to send each frame in a single write
+    renderer->rows = LINES;
+    renderer->cols = COLS;
+    return true;
 }
 
-//--------------  MENU FUNCTION ------------- 
+void CursesEnd(RENDERER* renderer) {
+    endwin();
+    renderer->screen = NULL;
+}
 
-void Welcome(WINDOW* mainwin) {
-    int choice;
-    int highlight = 0;
+void CursesOpen(WIN* w) {
+    w->window = subwin(w->renderer->screen, w->height, w->width, w->y, w->x);
+    wbkgd(w->window, COLOR_PAIR(w->color));
+    wrefresh(w->window);
+}
 
-    const char* choices[] = {               // Setup options
-        "Start Game",
-        "Instructions",
-        "Exit"
-    };
-    int n_choices = sizeof(choices) / sizeof(char*);
+void CursesClose(WIN* w) {
+    delwin(w->window);
+    w->window = NULL;
+}
 
-    keypad(mainwin, TRUE);
-    while (true) {
-        for (int i = 0; i < n_choices; ++i) {
-            if (i == highlight) {
-                wattron(mainwin, A_REVERSE);
-            }
-            mvwprintw(mainwin, i + 5, 5, choices[i]);
-            wattroff(mainwin, A_REVERSE);
-        }
-        choice = wgetch(mainwin);
+void CursesPut(WIN* w, int row, int col, char ch, int style) {
+    mvwaddch(w->window, row, col, (unsigned char)ch | CursesAttributes(style));
+}
 
-        switch (choice) {
-        case KEY_UP:
-            highlight = (highlight - 1 + n_choices) % n_choices;
-            break;
-        case KEY_DOWN:
-            highlight = (highlight + 1) % n_choices;
-            break;
-        case 10:
-            if (highlight == 0) {       // Start the game
-                wclear(mainwin);
-                wrefresh(mainwin);
-                return;
-            }
-            else if (highlight == 1) {      // Instructions
-                wclear(mainwin);
-                mvwprintw(mainwin, 5, 5, "Instructions:");
-                mvwprintw(mainwin, 7, 5, "Use arrows keys to move the frog.");
-                mvwprintw(mainwin, 9, 5, "Avoid cars and the stork and reach the other side of the road.");
-                mvwprintw(mainwin, 11, 5, "Press any key to return to the menu ...");
-                wrefresh(mainwin);
-                wgetch(mainwin);
-            }
-            else if (highlight == 2) {        // Exit the game
-                endwin();
-                exit(0);
-            }
-            break;
-        default:
-            break;
-        }
-        wclear(mainwin);
-    }
+void CursesPrint(WIN* w, int row, int col, int style, const char* text) {
+    wattron(w->window, CursesAttributes(style));
+    mvwaddstr(w->window, row, col, text);
+    wattroff(w->window, CursesAttributes(style));
 }
 
-//------------------------------------------------
-//----------------  WIN FUNCTIONS ----------------
-//------------------------------------------------
+void CursesErase(WIN* w) {
+    werase(w->window);
+}
 
-WIN* Init(WINDOW* parent, int rows, int cols, int y, int x, int color) {
-    WIN* w = new WIN;
-    w->x = x;
-    w->y = y;
-    w->width = cols;
-    w->height = rows;
-    w->color = color;
-    w->window = subwin(parent, w->height, w->width, w->y, w->x);
-    wbkgd(w->window, COLOR_PAIR(w->color));
-    wrefresh(w->window);
-    return w;
+void CursesBorder(WIN* w) {
+    box(w->window, 0, 0);
 }
 
-//------------------------------------------------
-//----------- ROADS & CARS FUNCTIONS -------------
-//------------------------------------------------
+void CursesStage(WIN* w) {
+    wnoutrefresh(w->window);
+}
 
-void InitCars(WIN* win, CAR cars[], int roadPositions[], int carsAndRoadsCount, int carLength, int carSpeed, int carMovingColor, int carStopColor, char carSign) {
-    for (int i = 0; i < carsAndRoadsCount; i++) {
-        cars[i].win = win;
-        cars[i].y = roadPositions[i];
-        cars[i].x = rand() % (win->width - 2 - carLength) + 1;
-        cars[i].length = rand() % carLength + 1;
-        cars[i].direction = (rand() % 2 == 0) ? 1 : -1;
-        cars[i].speed = rand() % carSpeed + 1;
-        cars[i].xSpeedChange = rand() % (win->width - 2 - carLength) + 1;
-        cars[i].alwaysMove = rand() % 2;
-        if (cars[i].alwaysMove == 1) cars[i].color = carMovingColor;
-        else  cars[i].color = carStopColor;
-        cars[i].sign = carSign;
-    }
+void CursesUpdate(RENDERER* renderer) {
+    doupdate();
 }
 
-bool CheckIfFrogIsOnCar(FROG* frog, CAR car) {
-    if (frog->y == car.y) {                         // Check if the frog is on the car
-        for (int j = 0; j < car.length; j++) {
-            if (frog->x == car.x + j * car.direction) {
-                return true;
-            }
+bool CursesBackedUp(RENDERER* renderer) {
+    return OutputBackedUp();            // curses writes whole updates, the best it can do is not start one
+}
+
+bool CursesSent(RENDERER* renderer, long long* bytes, long long* writes) {
+    return false;                       // Curses writes its own buffer, out of sight
+}
+
+int CursesReadKey(WIN* w) {
+    keypad(w->window, TRUE);    // Can use arrows
+    nodelay(w->window, FALSE);
+    return wgetch(w->window);
+}
+
+void CursesDropKeys(RENDERER* renderer) {
+    flushinp();
+}
+
+//--------------  NULL RENDERER -------------
+
+bool NullStart(RENDERER* renderer) {
+    renderer->rows = 0;
+    renderer->cols = 0;
+    return true;
+}
+
+void NullEnd(RENDERER* renderer) {}
+void NullWindow(WIN* w) {}
+void NullPut(WIN* w, int row, int col, char ch, int style) {}
+void NullPrint(WIN* w, int row, int col, int style, const char* text) {}
+void NullUpdate(RENDERER* renderer) {}
+bool NullBackedUp(RENDERER* renderer) { return false; }
+bool NullSent(RENDERER* renderer, long long* bytes, long long* writes) { return false; }
+int NullReadKey(WIN* w) { return ERR; }
+
+//--------------  ANSI RENDERER -------------
+
+ANSI_SCREEN* ansiTerminal = NULL;       // For the signal handler
+
+const char ANSI_ENTER[] = "\x1b[?1049h\x1b[?25l\x1b[0m\x1b(B\x1b[H\x1b[2J";      // Own screen, no cursor, blank
+const char ANSI_LEAVE[] = "\x1b[0m\x1b(B\x1b[?25h\x1b[?1049l";                   // and everything back
+
+void AnsiWrite(ANSI_SCREEN* screen, const char* bytes, int length) {
+    while (length > 0) {
+        ssize_t written = write(STDOUT_FILENO, bytes, length);
+        if (written <= 0) {
+            return;
         }
+        screen->sentBytes += written;
+        screen->sentWrites++;
+        bytes += written;
+        length -= int(written);
     }
-    return false;
 }
 
-bool CheckIfFrogIsClose(FROG* frog, CAR* car) {
-    if (car->alwaysMove == 1) {
+bool AnsiSend(ANSI_SCREEN* screen, bool wait) {
+    if (screen->outSent == screen->outLength) {
         return true;
     }
-    // Check if the frog is close to the car
-    for (int i = 0; i < car->length; i++) {
-        if (frog->y == car->y && abs(frog->x - (car->x + i * car->direction)) <= CAR_MAX_DISTANCE_FROM_FROG) {
-            return false;
+    if (!wait) {
+        fcntl(STDOUT_FILENO, F_SETFL, screen->outFlags | O_NONBLOCK);     // Only for this write, the shell shares the flags
+    }
+    while (screen->outSent < screen->outLength) {
+        ssize_t written = write(STDOUT_FILENO, screen->out + screen->outSent, screen->outLength - screen->outSent);
+        if (written <= 0) {
+            break;                      // Backed up, the rest is sent before the next update
         }
+        screen->outSent += int(written);
+        screen->sentBytes += written;
+        screen->sentWrites++;
     }
-    return true;
+    if (!wait) {
+        fcntl(STDOUT_FILENO, F_SETFL, screen->outFlags);
+    }
+    return screen->outSent == screen->outLength;
+}
+
+void AnsiRestore() {
+    fcntl(STDOUT_FILENO, F_SETFL, ansiTerminal->outFlags);     // A signal may come in the middle of a write that doesn't wait
+    AnsiSend(ansiTerminal, true);       // No sequence left cut in half
+    AnsiWrite(ansiTerminal, ANSI_LEAVE, sizeof(ANSI_LEAVE) - 1);
+    tcsetattr(STDIN_FILENO, TCSANOW, &ansiTerminal->saved);
 }
 
-void ResetCar(FROG* frog, CAR* car, int width, int y, int carLength, int carSpeed, int carMovingColor, int carStopColor) {
-    if (frog->carringCar != nullptr && car == frog->carringCar) {
-        car->speed = rand() % carSpeed + 1;                         // The same car when the frog is inside
-        car->xSpeedChange = rand() % (width - 2 - carLength) + 1;
+void AnsiSignal(int signal) {
+    AnsiRestore();                      // Ctrl-C must not leave the terminal raw
+    std::signal(signal, SIG_DFL);
+    raise(signal);
+}
+
+void AnsiOut(ANSI_SCREEN* screen, const char* bytes, int length) {
+    if (screen->outLength + length > screen->outCapacity) {
+        int capacity = max(screen->outCapacity * 2, screen->outLength + length);     // Grows a few times, then stays
+        char* out = new char[capacity];
+        memcpy(out, screen->out, screen->outLength);
+        delete[] screen->out;
+        screen->out = out;
+        screen->outCapacity = capacity;
+    }
+    memcpy(screen->out + screen->outLength, bytes, length);
+    screen->outLength += length;
+}
+
+void AnsiMove(ANSI_SCREEN* screen, int row, int col) {
+    if (row == screen->cursorRow && col == screen->cursorCol) {
+        return;
+    }
+    char text[32];
+    int length;
+    if (row == screen->cursorRow && col > screen->cursorCol) {
+        int gap = col - screen->cursorCol;
+        unsigned* skipped = screen->front + row * screen->cols + screen->cursorCol;
+        bool rewrite = gap < 4;                             // Shorter than the shortest cursor move forward
+        for (int i = 0; i < gap && rewrite; i++) {
+            rewrite = int(skipped[i] >> 8) == screen->style;
+        }
+        if (rewrite) {
+            for (int i = 0; i < gap; i++) {
+                text[i] = char(skipped[i] & 0xFF);          // The unchanged cells again, in the pen they have
+            }
+            length = gap;
+        }
+        else {
+            length = snprintf(text, sizeof(text), "\x1b[%dC", gap);
+        }
+    }
+    else if (row == screen->cursorRow && col == 0) {
+        length = snprintf(text, sizeof(text), "\r");
+    }
+    else if (col == 0) {
+        length = snprintf(text, sizeof(text), "\x1b[%dH", row + 1);
     }
     else {
-        car->length = rand() % carLength + 1;
-        car->speed = rand() % carSpeed + 1;
-        car->xSpeedChange = rand() % (width - 2 - carLength) + 1;       // New cars with new parameters when frog is outside
-        car->alwaysMove = rand() % 2;
-        if (car->alwaysMove == 1) car->color = carMovingColor;
-        else  car->color = carStopColor;
+        length = snprintf(text, sizeof(text), "\x1b[%d;%dH", row + 1, col + 1);
     }
-    car->x = (car->direction == 1) ? 0 - car->length : width + car->length - 1;     // Change the position of the car (depends on car direction)
+    AnsiOut(screen, text, length);
+    screen->cursorRow = row;
+    screen->cursorCol = col;
 }
 
-void DrawCars(CAR* car) {
-    wattron(car->win->window, COLOR_PAIR(car->color));
-    for (int i = 0; i < car->length; i++) {
-        int newX = car->x + i * car->direction;             // Draw the car on the new position (depends on car direction)
-        if (newX > 0 && newX < car->win->width - 1) {
-            mvwaddch(car->win->window, car->y, newX, car->sign);
-        }
+void AnsiStyle(ANSI_SCREEN* screen, int style) {
+    if (style == screen->style) {
+        return;
+    }
+    const PAIR_COLORS* from = &PAIRS[screen->style & RENDER_COLOR_MASK];
+    const PAIR_COLORS* to = &PAIRS[style & RENDER_COLOR_MASK];
+    char text[32];
+    int length = 0;
+    if (to->foreground != from->foreground) {                   // Only the parts that changed
+        length += snprintf(text + length, sizeof(text) - length, ";%d", to->foreground < 0 ? 39 : 30 + to->foreground);
+    }
+    if (to->background != from->background) {
+        length += snprintf(text + length, sizeof(text) - length, ";%d", to->background < 0 ? 49 : 40 + to->background);
+    }
+    if ((style ^ screen->style) & RENDER_REVERSE) {
+        length += snprintf(text + length, sizeof(text) - length, ";%d", (style & RENDER_REVERSE) ? 7 : 27);
+    }
+    if (length > 0) {
+        text[0] = 'm';                                          // "\x1b[" + parts without the first ';' + "m"
+        AnsiOut(screen, "\x1b[", 2);
+        AnsiOut(screen, text + 1, length - 1);
+        AnsiOut(screen, text, 1);
+    }
+    if ((style ^ screen->style) & RENDER_LINE) {
+        AnsiOut(screen, (style & RENDER_LINE) ? "\x1b(0" : "\x1b(B", 3);      // Line drawing character set
+    }
+    screen->style = style;
+}
+
+bool AnsiStart(RENDERER* renderer) {
+    termios saved;
+    if (!isatty(STDIN_FILENO) || !isatty(STDOUT_FILENO) || tcgetattr(STDIN_FILENO, &saved) != 0) {
+        return false;
+    }
+    winsize size;
+    bool sized = ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0 && size.ws_row > 0 && size.ws_col > 0;
+
+    ANSI_SCREEN* screen = new ANSI_SCREEN;
+    screen->rows = sized ? size.ws_row : ANSI_DEFAULT_ROWS;
+    screen->cols = sized ? size.ws_col : ANSI_DEFAULT_COLS;
+    int cells = screen->rows * screen->cols;
+    screen->back = new unsigned[cells];
+    screen->front = new unsigned[cells];
+    for (int i = 0; i < cells; i++) {
+        screen->back[i] = screen->front[i] = ' ';               // What ANSI_ENTER leaves on the terminal
     }
+    screen->dirtyFrom = new int[screen->rows];
+    screen->dirtyTo = new int[screen->rows];
+    for (int row = 0; row < screen->rows; row++) {
+        screen->dirtyFrom[row] = screen->cols;
+        screen->dirtyTo[row] = -1;
+    }
+    screen->outCapacity = cells * 4;                            // A full redraw usually fits
+    screen->out = new char[screen->outCapacity];
+    screen->outLength = 0;
+    screen->outSent = 0;
+    screen->outFlags = fcntl(STDOUT_FILENO, F_GETFL);
+    screen->sentBytes = 0;
+    screen->sentWrites = 0;
+    screen->cursorRow = 0;
+    screen->cursorCol = 0;
+    screen->style = 0;
+    screen->saved = saved;
+
+    termios raw = saved;
+    raw.c_lflag &= ~(ICANON | ECHO);                            // Keys one by one and not echoed, as curses' cbreak and noecho
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+    ansiTerminal = screen;
+    std::signal(SIGINT, AnsiSignal);
+    std::signal(SIGTERM, AnsiSignal);
+    AnsiWrite(screen, ANSI_ENTER, sizeof(ANSI_ENTER) - 1);
+
+    renderer->ansi = screen;
+    renderer->rows = screen->rows;
+    renderer->cols = screen->cols;
+    return true;
+}
 
-    wattroff(car->win->window, COLOR_PAIR(car->color));
+void AnsiEnd(RENDERER* renderer) {
+    ANSI_SCREEN* screen = renderer->ansi;
+    std::signal(SIGINT, SIG_DFL);
+    std::signal(SIGTERM, SIG_DFL);
+    AnsiRestore();
+    ansiTerminal = NULL;
+    delete[] screen->back;
+    delete[] screen->front;
+    delete[] screen->dirtyFrom;
+    delete[] screen->dirtyTo;
+    delete[] screen->out;
+    delete screen;
+    renderer->ansi = NULL;
 }
 
-void EraseCars(CAR* car, int** positionType) {
-    for (int i = 0; i < car->length; i++) {
-        int newX = car->x + i * car->direction;             // Erase the last position of the car
-        if (newX > 0 && newX < car->win->width - 1) {
-            wattron(car->win->window, COLOR_PAIR(ROAD_COLOR));
-            mvwaddch(car->win->window, car->y, newX, ' ');
-            wattroff(car->win->window, COLOR_PAIR(ROAD_COLOR));
-        }
+void AnsiWindow(WIN* w) {}              // Windows are places on the one screen, nothing to create or free
+
+void AnsiPut(WIN* w, int row, int col, char ch, int style) {
+    ANSI_SCREEN* screen = w->renderer->ansi;
+    int y = w->y + row;
+    int x = w->x + col;
+    if (row < 0 || row >= w->height || col < 0 || col >= w->width || y >= screen->rows || x >= screen->cols) {
+        return;                                                 // Outside the window or the terminal
     }
+    screen->back[y * screen->cols + x] = (unsigned char)ch | unsigned(style) << 8;
+    screen->dirtyFrom[y] = min(screen->dirtyFrom[y], x);
+    screen->dirtyTo[y] = max(screen->dirtyTo[y], x);
 }
 
-void MoveCars(CAR cars[], TIMER* timer, FROG* frog, int** positionType, int carsAndRoadsCount, int carLength, int carSpeed, int carMoveColor, int carStopColor) {
-    for (int i = 0; i < carsAndRoadsCount; i++) {
-        EraseCars(&cars[i], positionType);    // Erase the cars
-        if (timer->carsTime % cars[i].speed == 0 && CheckIfFrogIsClose(frog, &cars[i])) {       // Move cars if the time is right
-            cars[i].x += cars[i].direction;                                                     // and frog far enough from the friendly cars
-        }
-        if (cars[i].xSpeedChange == cars[i].x) {                    // Change the speed of the car during the game
-            cars[i].speed = rand() % carSpeed + 1;
-        }
+void AnsiPrint(WIN* w, int row, int col, int style, const char* text) {
+    if ((style & RENDER_COLOR_MASK) == 0) {
+        style |= w->color;
+    }
+    for (int i = 0; text[i] != '\0'; i++) {
+        AnsiPut(w, row, col + i, text[i], style);               // Cut at the window's edge
+    }
+}
 
-        if (frog->carried && frog->carringCar == &cars[i] && timer->carsTime % frog->carringCar->speed == 0) {
-            frog->carringCar->x += cars[i].direction;               // Move the car when the frog inside   
-            frog->x = frog->carringCar->x;
+void AnsiErase(WIN* w) {
+    for (int row = 0; row < w->height; row++) {
+        for (int col = 0; col < w->width; col++) {
+            AnsiPut(w, row, col, ' ', w->color);
         }
+    }
+}
 
-        if ((cars[i].direction == 1 && cars[i].x - cars[i].length > cars[i].win->width - 2)
-            || (cars[i].direction == -1 && cars[i].x < 1 - cars[i].length)) {
-            ResetCar(frog, &cars[i], cars[i].win->width, cars[i].y, carLength, carSpeed, carMoveColor, carStopColor);       // New cars after they leave the border
-        }
-        DrawCars(&cars[i]);     // Draw the cars
+void AnsiBorder(WIN* w) {
+    int style = w->color | RENDER_LINE;                         // DEC line drawing: l k m j corners, q and x lines
+    for (int col = 1; col < w->width - 1; col++) {
+        AnsiPut(w, 0, col, 'q', style);
+        AnsiPut(w, w->height - 1, col, 'q', style);
     }
+    for (int row = 1; row < w->height - 1; row++) {
+        AnsiPut(w, row, 0, 'x', style);
+        AnsiPut(w, row, w->width - 1, 'x', style);
+    }
+    AnsiPut(w, 0, 0, 'l', style);
+    AnsiPut(w, 0, w->width - 1, 'k', style);
+    AnsiPut(w, w->height - 1, 0, 'm', style);
+    AnsiPut(w, w->height - 1, w->width - 1, 'j', style);
 }
 
-bool CarColision(FROG* frog, CAR cars[], TIMER* timer, int carsAndRoadsCount) {
-    for (int i = 0; i < carsAndRoadsCount; i++) {
-        if (frog->y == cars[i].y && cars[i].alwaysMove != 0) {          // Check collisions with red (enemy) cars
-            for (int j = 0; j < cars[i].length; j++) {
-                if (frog->x == cars[i].x + j * cars[i].direction) {
-                    return true;
-                }
+void AnsiUpdate(RENDERER* renderer) {
+    ANSI_SCREEN* screen = renderer->ansi;
+    AnsiSend(screen, true);                                     // The rest of the last update first
+    screen->outLength = 0;
+    screen->outSent = 0;
+    for (int row = 0; row < screen->rows; row++) {
+        unsigned* back = screen->back + row * screen->cols;
+        unsigned* front = screen->front + row * screen->cols;
+        for (int col = screen->dirtyFrom[row]; col <= screen->dirtyTo[row]; col++) {
+            if (back[col] == front[col]) {
+                continue;                                       // Drawn again as it was
+            }
+            AnsiMove(screen, row, col);
+            AnsiStyle(screen, int(back[col] >> 8));
+            char ch = char(back[col] & 0xFF);
+            AnsiOut(screen, &ch, 1);
+            front[col] = back[col];
+            screen->cursorCol = col + 1;
+            if (screen->cursorCol == screen->cols) {
+                screen->cursorRow = screen->cursorCol = -1;     // Terminals differ at the last column
             }
         }
+        screen->dirtyFrom[row] = screen->cols;
+        screen->dirtyTo[row] = -1;
     }
-    return false;
+    AnsiSend(screen, false);                                    // One write per frame, none of them blocks the game
 }
 
-//------------------------------------------------
-//----------------  FROG FUNCTIONS ---------------
-//------------------------------------------------
+bool AnsiBackedUp(RENDERER* renderer) {
+    return !AnsiSend(renderer->ansi, false) || OutputBackedUp();       // Changes wait in the back buffer and go with a later frame
+}
 
-bool CheckFrogStartPosition(int** positionType, int x, int y) {
-    if (positionType[y][x] == OBSTACLE || positionType[y][x] == COIN) {     // Frog can't start from obstacle or coin
-        return false;
-    }
+bool AnsiSent(RENDERER* renderer, long long* bytes, long long* writes) {
+    *bytes = renderer->ansi->sentBytes;
+    *writes = renderer->ansi->sentWrites;
     return true;
 }
 
-FROG* InitFrog(WIN* w, int frogColor, char frogSign, int maxMoves, int** positionType) {
-    FROG* frog = new FROG;
-    frog->win = w;
-    frog->x = rand() % (w->width - 2) + 1;
-    frog->y = w->height - 2;
-    while (!CheckFrogStartPosition(positionType, frog->x, frog->y)) {
-        frog->x = rand() % (w->width - 2) + 1;
+int AnsiReadKey(WIN* w) {
+    AnsiSend(w->renderer->ansi, true);  // The screen asking for the key must be out
+    unsigned char c;
+    int escape = 0;                     // Bytes of an arrow key seen so far (ESC [ A or ESC O A), as KeyReader
+    while (read(STDIN_FILENO, &c, 1) == 1) {
+        if (escape == 1) {
+            escape = (c == '[' || c == 'O') ? 2 : 0;
+        }
+        else if (escape == 2) {
+            if (c == 'A') return KEY_UP;
+            if (c == 'B') return KEY_DOWN;
+            if (c == 'C') return KEY_RIGHT;
+            if (c == 'D') return KEY_LEFT;
+            escape = 0;
+        }
+        else if (c == 27) {
+            pollfd poller = { STDIN_FILENO, POLLIN, 0 };
+            if (poll(&poller, 1, KEY_POLL_MS) <= 0) {
+                return 27;              // Escape on its own
+            }
+            escape = 1;
+        }
+        else {
+            return c;
+        }
     }
-    frog->points = 0;
-    frog->remainingMoves = maxMoves;
-    frog->maxMoves = maxMoves;
-    frog->color = frogColor;
-    frog->sign = frogSign;
-    frog->carried = false;
-    frog->carringCar = nullptr;
-    return frog;
+    return ERR;
 }
 
-void DrawFrog(FROG* frog) {
-    wattron(frog->win->window, COLOR_PAIR(frog->color));        // Draw frog
-    mvwaddch(frog->win->window, frog->y, frog->x, frog->sign);
-    wattroff(frog->win->window, COLOR_PAIR(frog->color));
-    wrefresh(frog->win->window);
+void AnsiDropKeys(RENDERER* renderer) {
+    tcflush(STDIN_FILENO, TCIFLUSH);
 }
 
-void EraseFrog(FROG* frog, int** positionType) {
-    int mapY = frog->y;
-    int mapX = frog->x;
+RENDERER RENDERERS[] = {
+    { "curses", true, CursesStart, CursesEnd, CursesOpen, CursesClose, CursesPut, CursesPrint, CursesErase, CursesBorder,
+        CursesStage, CursesUpdate, CursesBackedUp, CursesSent, CursesReadKey, CursesDropKeys, 0, 0, 0, NULL, NULL },
+    { "ansi", true, AnsiStart, AnsiEnd, AnsiWindow, AnsiWindow, AnsiPut, AnsiPrint, AnsiErase, AnsiBorder,
+        AnsiWindow, AnsiUpdate, AnsiBackedUp, AnsiSent, AnsiReadKey, AnsiDropKeys, 0, 0, 0, NULL, NULL },       // Every window is staged by drawing
+    { "null", false, NullStart, NullEnd, NullWindow, NullWindow, NullPut, NullPrint, NullWindow, NullWindow,
+        NullWindow, NullUpdate, NullBackedUp, NullSent, NullReadKey, NullEnd, 0, 0, 0, NULL, NULL }
+};
+#define RENDERER_COUNT 3
+#define NULL_RENDERER (&RENDERERS[RENDERER_COUNT - 1])      // Headless windows
 
-    int color = 0;
-    char ch = ' ';
-    switch (positionType[mapY][mapX]) {
-    case GRASS:     // Grass
+RENDERER* FindRenderer(const char* name) {
+    for (int i = 0; i < RENDERER_COUNT; i++) {
+        if (strcmp(RENDERERS[i].name, name) == 0) {
+            return &RENDERERS[i];
+        }
+    }
+    return NULL;
+}
+
+//--------------  MENU FUNCTION ------------- 
+
+void Welcome(WIN* menu) {
+    RENDERER* renderer = menu->renderer;
+    int choice;
+    int highlight = 0;
+
+    const char* choices[] = {               // Setup options
+        "Start Game",
+        "Instructions",
+        "Exit"
+    };
+    int n_choices = sizeof(choices) / sizeof(char*);
+
+    while (true) {
+        for (int i = 0; i < n_choices; ++i) {
+            renderer->print(menu, i + 5, 5, (i == highlight) ? RENDER_REVERSE : 0, choices[i]);
+        }
+        renderer->stage(menu);
+        renderer->update(renderer);
+        choice = renderer->readKey(menu);
+
+        switch (choice) {
+        case KEY_UP:
+            highlight = (highlight - 1 + n_choices) % n_choices;
+            break;
+        case KEY_DOWN:
+            highlight = (highlight + 1) % n_choices;
+            break;
+        case 10:
+            if (highlight == 0) {       // Start the game
+                renderer->erase(menu);
+                renderer->stage(menu);
+                renderer->update(renderer);
+                return;
+            }
+            else if (highlight == 1) {      // Instructions
+                renderer->erase(menu);
+                renderer->print(menu, 5, 5, 0, "Instructions:");
+                renderer->print(menu, 7, 5, 0, "Use arrows keys to move the frog.");
+                renderer->print(menu, 9, 5, 0, "Avoid cars and the stork and reach the other side of the road.");
+                renderer->print(menu, 11, 5, 0, "Press any key to return to the menu ...");
+                renderer->stage(menu);
+                renderer->update(renderer);
+                renderer->readKey(menu);
+            }
+            else if (highlight == 2) {        // Exit the game
+                renderer->end(renderer);
+                exit(0);
+            }
+            break;
+        default:
+            break;
+        }
+        renderer->erase(menu);
+    }
+}
+
+//------------------------------------------------
+//----------------  ARENA FUNCTIONS --------------
+//------------------------------------------------
+
+std::atomic<long long> heapAllocations(0);      // Every operator new of the program, any thread
+std::atomic<long long> heapFrees(0);
+
+void* operator new(size_t size) {
+    heapAllocations.fetch_add(1, std::memory_order_relaxed);
+    void* p = malloc(size > 0 ? size : 1);
+    if (p == NULL) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+#ifdef __GNUC__
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"      // Where delete is inlined g++ sees free() on memory from new, which came from malloc above
+#endif
+void operator delete(void* p) noexcept {
+    if (p != NULL) {
+        heapFrees.fetch_add(1, std::memory_order_relaxed);
+        free(p);
+    }
+}
+#ifdef __GNUC__
+#pragma GCC diagnostic pop
+#endif
+
+void operator delete[](void* p) noexcept {
+    operator delete(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    operator delete(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+    operator delete(p);
+}
+
+long long HeapBlocksHeld() {
+    return heapAllocations.load(std::memory_order_relaxed) - heapFrees.load(std::memory_order_relaxed);
+}
+
+void InitArena(ARENA* arena) {
+    arena->block = NULL;            // The first round sizes the block
+    arena->capacity = 0;
+    arena->used = 0;
+    arena->overflow = NULL;
+    arena->overflowCount = 0;
+    arena->overflowCapacity = 0;
+    arena->overflowBytes = 0;
+    arena->peak = 0;
+    arena->allocations = 0;
+    arena->heapBlocks = 0;
+}
+
+void* ArenaAlloc(ARENA* arena, size_t bytes) {
+    bytes = (bytes + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    arena->allocations++;
+    if (arena->used + bytes <= arena->capacity) {
+        void* p = arena->block + arena->used;
+        arena->used += bytes;
+        arena->peak = std::max(arena->peak, arena->used + arena->overflowBytes);
+        return p;
+    }
+    if (arena->overflowCount == arena->overflowCapacity) {         // Only until the block has grown
+        int capacity = arena->overflowCapacity > 0 ? 2 * arena->overflowCapacity : 16;
+        char** overflow = new char*[capacity];
+        if (arena->overflowCount > 0) {
+            memcpy(overflow, arena->overflow, sizeof(char*) * arena->overflowCount);
+        }
+        delete[] arena->overflow;
+        arena->overflow = overflow;
+        arena->overflowCapacity = capacity;
+    }
+    char* p = new char[bytes > 0 ? bytes : ARENA_ALIGN];
+    arena->overflow[arena->overflowCount++] = p;
+    arena->overflowBytes += bytes;
+    arena->heapBlocks++;
+    arena->peak = std::max(arena->peak, arena->used + arena->overflowBytes);
+    return p;
+}
+
+template <typename T>
+T* ArenaArray(ARENA* arena, long long count) {
+    return (T*)ArenaAlloc(arena, sizeof(T) * (count > 0 ? count : 1));       // Plain structs only, no constructors run
+}
+
+template <typename T>
+T* ArenaNew(ARENA* arena) {
+    return ArenaArray<T>(arena, 1);
+}
+
+size_t ArenaMark(ARENA* arena) {
+    return arena->used;
+}
+
+void ArenaRewind(ARENA* arena, size_t mark) {
+    arena->used = mark;             // Gives back the block taken since the mark (overflow waits for the reset)
+}
+
+void ResetArena(ARENA* arena) {
+    for (int i = 0; i < arena->overflowCount; i++) {
+        delete[] arena->overflow[i];
+    }
+    if (arena->peak > arena->capacity) {                        // One block the size of the whole round,
+        delete[] arena->block;                                  // so the next round of the config takes nothing from the heap
+        arena->capacity = std::max(arena->peak, (size_t)ARENA_MIN_BLOCK);
+        arena->block = new char[arena->capacity];
+        arena->heapBlocks++;
+    }
+    arena->used = 0;
+    arena->overflowCount = 0;
+    arena->overflowBytes = 0;
+    arena->peak = 0;
+    arena->allocations = 0;
+}
+
+void FreeArena(ARENA* arena) {
+    for (int i = 0; i < arena->overflowCount; i++) {
+        delete[] arena->overflow[i];
+    }
+    delete[] arena->overflow;
+    delete[] arena->block;
+    InitArena(arena);
+}
+
+//------------------------------------------------
+//----------------  WIN FUNCTIONS ----------------
+//------------------------------------------------
+
+WIN* Init(ARENA* arena, RENDERER* renderer, int rows, int cols, int y, int x, int color) {
+    WIN* w = ArenaNew<WIN>(arena);
+    w->x = x;
+    w->y = y;
+    w->width = cols;
+    w->height = rows;
+    w->color = color;
+    w->scrollY = 0;
+    w->window = NULL;
+    w->renderer = (renderer != NULL) ? renderer : NULL_RENDERER;      // Headless window (size only) without one
+    w->renderer->open(w);
+    return w;
+}
+
+void Print(WIN* w, int row, int col, const char* format, ...) {
+    char text[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    w->renderer->print(w, row, col, 0, text);          // In the window's color
+}
+
+//------------------------------------------------
+//----------------  RANDOM FUNCTIONS -------------
+//------------------------------------------------
+
+void SeedRandom(RNG* rng, unsigned long long seed) {
+    rng->state = seed;
+}
+
+inline unsigned long long MixBits(unsigned long long z) {
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+unsigned long long NextRandom(RNG* rng) {
+    return MixBits(rng->state += 0x9E3779B97F4A7C15ULL);        // SplitMix64, owned by the round
+}
+
+int Random(RNG* rng, int n) {
+    return int(((NextRandom(rng) >> 32) * (unsigned long long)n) >> 32);      // 0 .. n-1 without a division
+}
+
+inline unsigned long long HashKey(int kind, int index, unsigned long long value) {
+    unsigned long long entity = (unsigned long long)(unsigned)index << 8 | (unsigned)kind;
+    return MixBits(entity * 0x9E3779B97F4A7C15ULL + value);      // A Zobrist table as large as needed, made on the fly instead of stored
+}
+
+//------------------------------------------------
+//----------------  MAP FUNCTIONS ----------------
+//------------------------------------------------
+
+MAP* InitMap(ARENA* arena, int rows, int cols) {
+    MAP* map = ArenaNew<MAP>(arena);
+    map->rows = rows;
+    map->cols = cols;
+    map->stride = cols;
+    map->cells = ArenaArray<unsigned char>(arena, (long long)rows * cols);      // One block instead of a row per allocation
+    map->top = 0;
+    map->head = 0;
+    map->changes = 0;
+    map->hash = 0;
+    return map;
+}
+
+inline int RingRow(int y, int top, int head, int rows) {
+    int row = head + y - top;               // World row to ring row, y must be in [top, top + rows)
+    return (row >= rows) ? row - rows : row;
+}
+
+inline unsigned char MapCell(MAP* map, int y, int x) {
+    return map->cells[RingRow(y, map->top, map->head, map->rows) * map->stride + x];
+}
+
+inline void SetMapCell(MAP* map, int y, int x, unsigned char type) {
+    map->cells[RingRow(y, map->top, map->head, map->rows) * map->stride + x] = type;
+}
+
+inline unsigned long long CellKey(int y, int x, unsigned char type) {
+    return HashKey(HASH_CELL, 0, (unsigned long long)(unsigned)y << 32 | (unsigned)x << 8 | type);
+}
+
+unsigned long long RowHash(MAP* map, int y, int worldY) {
+    unsigned char* cells = &map->cells[RingRow(y, map->top, map->head, map->rows) * map->stride];
+    unsigned long long hash = 0;
+    for (int x = 0; x < map->cols; x++) {
+        hash ^= CellKey(worldY, x, cells[x]);          // The ring row of y, as world row worldY
+    }
+    return hash;
+}
+
+unsigned long long MapHash(MAP* map, int bottom) {
+    unsigned long long hash = 0;
+    for (int y = map->top; y < map->top + map->rows && y < bottom; y++) {      // Rows below bottom were never made
+        hash ^= RowHash(map, y, y);
+    }
+    return hash;
+}
+
+inline void ReplaceMapCell(MAP* map, int y, int x, unsigned char type) {
+    map->hash ^= CellKey(y, x, MapCell(map, y, x)) ^ CellKey(y, x, type);
+    SetMapCell(map, y, x, type);
+}
+
+inline void ChangeMapCell(MAP* map, int y, int x, unsigned char type) {
+    ReplaceMapCell(map, y, x, type);                    // During play, so the spectator feed can pass it on
+    int slot = int(map->changes++ % MAP_CHANGE_LOG);
+    map->changeY[slot] = y;
+    map->changeX[slot] = x;
+}
+
+//------------------------------------------------
+//-------------  OCCUPANCY FUNCTIONS -------------
+//------------------------------------------------
+
+inline int OccupancyRow(OCCUPANCY* occupancy, int y) {
+    return RingRow(y, occupancy->top, occupancy->head, occupancy->rows);
+}
+
+void SetOccupied(OCCUPANCY* occupancy, int y, int x, bool occupied) {
+    int bit = x + occupancy->padding;
+    if (bit < 0 || bit >= occupancy->width) {
+        return;                                 // Off the board, not tracked
+    }
+    unsigned long long* word = &occupancy->bits[OccupancyRow(occupancy, y) * occupancy->words + bit / 64];
+    if (occupied) *word |= 1ULL << (bit % 64);
+    else *word &= ~(1ULL << (bit % 64));
+}
+
+bool IsRangeOccupied(OCCUPANCY* occupancy, int y, int fromX, int toX) {
+    int first = fromX + occupancy->padding;
+    int last = toX + occupancy->padding;
+    if (first < 0) first = 0;
+    if (last >= occupancy->width) last = occupancy->width - 1;
+    if (y < occupancy->top || y >= occupancy->top + occupancy->rows || first > last) {
+        return false;
+    }
+    unsigned long long* row = &occupancy->bits[OccupancyRow(occupancy, y) * occupancy->words];
+    for (int w = first / 64; w <= last / 64; w++) {            // Mask the requested columns out of each word
+        unsigned long long mask = ~0ULL;
+        if (w == first / 64) mask &= ~0ULL << (first % 64);
+        if (w == last / 64 && last % 64 != 63) mask &= (1ULL << (last % 64 + 1)) - 1;
+        if (row[w] & mask) {
+            return true;
+        }
+    }
+    return false;
+}
+
+inline int LaneCar(OCCUPANCY* occupancy, int row, int k) {
+    int slot = occupancy->laneHead[row] + k;            // k-th car from the front
+    if (slot >= occupancy->perLane) slot -= occupancy->perLane;
+    return occupancy->lane[row * occupancy->perLane + slot];
+}
+
+int CarOnCell(OCCUPANCY* occupancy, int y, int x) {
+    if (!IsRangeOccupied(occupancy, y, x, x)) {
+        return -1;
+    }
+    CARS* cars = occupancy->cars;
+    int row = OccupancyRow(occupancy, y);
+    int onBoard = occupancy->laneCount[row] - occupancy->laneWaiting[row];
+    int direction = cars->direction[LaneCar(occupancy, row, 0)];        // The same for the whole lane
+    int low = 0;
+    int high = onBoard;
+    while (low < high) {                                // First car from the front whose back is behind the cell
+        int mid = (low + high) / 2;
+        if (cars->x[LaneCar(occupancy, row, mid)] * direction <= x * direction) high = mid;
+        else low = mid + 1;
+    }
+    if (low == onBoard) {
+        return -1;
+    }
+    int car = LaneCar(occupancy, row, low);
+    return (x * direction <= cars->x[car] * direction + cars->length[car] - 1) ? car : -1;
+}
+
+bool CarFits(OCCUPANCY* occupancy, CARS* cars, int i) {
+    int end = cars->x[i] + (cars->length[i] - 1) * cars->direction[i];
+    return !IsRangeOccupied(occupancy, cars->y[i], std::min(cars->x[i], end), std::max(cars->x[i], end));
+}
+
+bool CanShiftCar(OCCUPANCY* occupancy, CARS* cars, int i) {
+    int cell = cars->x[i] + cars->length[i] * cars->direction[i];
+    return !IsRangeOccupied(occupancy, cars->y[i], cell, cell);         // Never into the car ahead
+}
+
+void MarkCar(OCCUPANCY* occupancy, CARS* cars, int i, bool occupied) {
+    for (int j = 0; j < cars->length[i]; j++) {
+        SetOccupied(occupancy, cars->y[i], cars->x[i] + j * cars->direction[i], occupied);
+    }
+}
+
+void ShiftCar(OCCUPANCY* occupancy, CARS* cars, int i) {
+    SetOccupied(occupancy, cars->y[i], cars->x[i], false);                                      // Only the last cell leaves
+    SetOccupied(occupancy, cars->y[i], cars->x[i] + cars->length[i] * cars->direction[i], true);  // and one new cell enters
+    cars->x[i] += cars->direction[i];
+}
+
+void TouchCar(CARS* cars, int i) {
+    cars->touch[i >> 6] |= 1ULL << (i & 63);
+}
+
+inline unsigned long long CarPlace(CARS* cars, int i) {
+    return (unsigned long long)(unsigned)cars->y[i] << 32 | (unsigned)cars->x[i];
+}
+
+inline unsigned long long CarRest(CARS* cars, int i) {
+    return (unsigned long long)(cars->length[i] & 0xFFF) | (unsigned long long)(cars->speed[i] & 0xFFF) << 12
+        | (unsigned long long)(cars->xSpeedChange[i] & 0xFFFF) << 24 | (unsigned long long)cars->flags[i] << 40
+        | (unsigned long long)cars->color[i] << 48 | (unsigned long long)(cars->direction[i] == 1) << 56;
+}
+
+inline unsigned long long CarRestKey(CARS* cars, int i) {
+    return HashKey(HASH_CAR, i, CarRest(cars, i));      // Apart from the place, which changes far more often
+}
+
+inline unsigned long long CarKey(CARS* cars, int i) {
+    return HashKey(HASH_CAR_PLACE, i, CarPlace(cars, i)) ^ CarRestKey(cars, i);
+}
+
+inline unsigned long long CarMoveKey(CARS* cars, int i, unsigned long long place) {
+    unsigned long long placeNow = CarPlace(cars, i);        // What the hash takes for car i to move from place
+    return (placeNow == place) ? 0 : HashKey(HASH_CAR_PLACE, i, place) ^ HashKey(HASH_CAR_PLACE, i, placeNow);
+}
+
+unsigned long long CarsHash(CARS* cars) {
+    unsigned long long hash = 0;
+    for (int i = 0; i < cars->count; i++) {
+        hash ^= CarKey(cars, i);
+    }
+    return hash;
+}
+
+void RecolorCar(CARS* cars, int i, int color) {
+    cars->hash ^= CarRestKey(cars, i);
+    cars->color[i] = (unsigned char)color;
+    cars->hash ^= CarRestKey(cars, i);
+}
+
+void FillLane(OCCUPANCY* occupancy, CARS* cars, int first, int count, int width) {
+    if (count == 0) {
+        return;
+    }
+    int row = OccupancyRow(occupancy, cars->y[first]);
+    int* lane = &occupancy->lane[row * occupancy->perLane];
+    int direction = cars->direction[first];
+    int placed = 0;
+    for (int i = first; i < first + count; i++) {       // Cars that fit go on the board, in the order they were placed
+        if (CarFits(occupancy, cars, i)) {
+            MarkCar(occupancy, cars, i, true);
+            lane[placed++] = i;
+        }
+        else {
+            cars->flags[i] |= CAR_WAITING;
+        }
+    }
+    if (direction == 1) {
+        std::reverse(lane, lane + placed);              // The front is the last one placed
+    }
+    for (int k = 1; k < placed; k++) {                  // Front to back (already so, unless placement changes)
+        int car = lane[k];
+        int j = k;
+        for (; j > 0 && cars->x[lane[j - 1]] * direction < cars->x[car] * direction; j--) {
+            lane[j] = lane[j - 1];
+        }
+        lane[j] = car;
+    }
+    int waiting = 0;
+    for (int i = first; i < first + count; i++) {
+        if (cars->flags[i] & CAR_WAITING) {
+            cars->x[i] = (direction == 1) ? 0 - cars->length[i] : width + cars->length[i] - 1;      // Behind the entry
+            lane[placed + waiting++] = i;
+        }
+    }
+    occupancy->laneHead[row] = 0;
+    occupancy->laneCount[row] = placed + waiting;
+    occupancy->laneWaiting[row] = waiting;
+    for (int k = 0; k < placed + waiting; k++) {
+        occupancy->carSlot[lane[k]] = k;
+    }
+    if (waiting > 0) {
+        TouchCar(cars, lane[placed]);                   // The first waiting car tries to enter every tick
+    }
+    for (int i = first; i < first + count; i++) {
+        cars->hash ^= CarKey(cars, i);                  // New cars, as they start
+    }
+}
+
+bool EnterLane(OCCUPANCY* occupancy, CARS* cars, int i) {
+    int row = OccupancyRow(occupancy, cars->y[i]);
+    int onBoard = occupancy->laneCount[row] - occupancy->laneWaiting[row];
+    if (LaneCar(occupancy, row, onBoard) != i) {
+        return false;                                   // Waiting cars enter in turn
+    }
+    if (!CarFits(occupancy, cars, i)) {
+        TouchCar(cars, i);
+        return false;
+    }
+    MarkCar(occupancy, cars, i, true);
+    cars->flags[i] &= ~CAR_WAITING;
+    if (--occupancy->laneWaiting[row] > 0) {
+        TouchCar(cars, LaneCar(occupancy, row, onBoard + 1));
+    }
+    return true;
+}
+
+void ReenterLane(OCCUPANCY* occupancy, CARS* cars, int i) {
+    int row = OccupancyRow(occupancy, cars->y[i]);
+    int perLane = occupancy->perLane;
+    int count = occupancy->laneCount[row];
+    int head = occupancy->laneHead[row];
+    int back = head + count;                            // The front car (i) goes to the back of the ring
+    if (back >= perLane) back -= perLane;
+    occupancy->lane[row * perLane + back] = i;
+    occupancy->carSlot[i] = back;
+    occupancy->laneHead[row] = (head + 1 < perLane) ? head + 1 : 0;
+    if (occupancy->laneWaiting[row] > 0 || !CarFits(occupancy, cars, i)) {
+        cars->flags[i] |= CAR_WAITING;                  // Behind the cars already waiting, whatever the room
+        if (++occupancy->laneWaiting[row] == 1) {
+            TouchCar(cars, i);
+        }
+        return;
+    }
+    MarkCar(occupancy, cars, i, true);
+}
+
+OCCUPANCY* InitOccupancy(ARENA* arena, CARS* cars, int rows, int cols, int carLength, int perLane) {
+    OCCUPANCY* occupancy = ArenaNew<OCCUPANCY>(arena);
+    occupancy->rows = rows;
+    occupancy->padding = 2 * carLength + CAR_MAX_DISTANCE_FROM_FROG;
+    occupancy->width = cols + 2 * occupancy->padding;
+    occupancy->words = (occupancy->width + 63) / 64;
+    occupancy->bits = ArenaArray<unsigned long long>(arena, rows * occupancy->words);
+    occupancy->cars = cars;
+    occupancy->perLane = perLane;
+    occupancy->lane = ArenaArray<int>(arena, (long long)rows * perLane);
+    occupancy->laneHead = ArenaArray<int>(arena, rows);
+    occupancy->laneCount = ArenaArray<int>(arena, rows);
+    occupancy->laneWaiting = ArenaArray<int>(arena, rows);
+    occupancy->carSlot = ArenaArray<int>(arena, cars->capacity);
+    occupancy->top = 0;
+    occupancy->head = 0;
+    memset(occupancy->bits, 0, sizeof(unsigned long long) * rows * occupancy->words);
+    for (int y = 0; y < rows; y++) {
+        occupancy->laneHead[y] = 0;
+        occupancy->laneCount[y] = 0;
+        occupancy->laneWaiting[y] = 0;
+    }
+    for (int i = 0, j; i < cars->count; i = j) {
+        for (j = i + 1; j < cars->count && cars->y[j] == cars->y[i]; j++) {}     // The cars of a road come one after the other
+        FillLane(occupancy, cars, i, j - i, cols);
+    }
+    return occupancy;
+}
+
+void MarkAllCars(OCCUPANCY* occupancy, CARS* cars) {
+    memset(occupancy->bits, 0, sizeof(unsigned long long) * occupancy->rows * occupancy->words);
+    for (int i = 0; i < cars->count; i++) {
+        if (!(cars->flags[i] & CAR_WAITING)) {
+            MarkCar(occupancy, cars, i, true);      // Cars never overlap, so the bits are just their cells
+        }
+    }
+}
+
+void ClearOccupancyRow(OCCUPANCY* occupancy, int y) {
+    int row = OccupancyRow(occupancy, y);
+    memset(&occupancy->bits[row * occupancy->words], 0, sizeof(unsigned long long) * occupancy->words);
+    occupancy->laneHead[row] = 0;
+    occupancy->laneCount[row] = 0;
+    occupancy->laneWaiting[row] = 0;
+}
+
+//------------------------------------------------
+//-------------  CAR KERNEL FUNCTIONS ------------
+//------------------------------------------------
+
+struct CAR_STEP {               // A tick of MoveCars as the car kernels see it
+    const unsigned char* dueBySpeed;
+    const int* dueSpeeds;       // The speeds that move this tick
+    int dueCount;
+    int frogX;
+    int frogY;
+    int carried;                // Car with the frog inside (-1 if none)
+    int width;
+};
+
+// Splits the cars of a tick in two bitsets: shift gets the cars that only move one cell (due, far enough from the frog,
+// not on their speed change cell, not leaving the board, not touched), visit gets touch and the other cars that are due.
+// Only right for lanes of one car, where a car can always move (see MoveCars).
+typedef void (*STEP_CARS_KERNEL)(const CARS* cars, const CAR_STEP* step, const unsigned long long* touch, unsigned long long* shift, unsigned long long* visit);
+
+struct CAR_KERNELS {
+    const char* name;
+    STEP_CARS_KERNEL stepCars;
+};
+
+bool CarShiftsAlone(const CARS* cars, const CAR_STEP* step, int i) {
+    if ((cars->flags[i] & CAR_WAITING) || i == step->carried) {
+        return false;
+    }
+    int x = cars->x[i];
+    int direction = cars->direction[i];
+    int end = x + (cars->length[i] - 1) * direction;
+    if (!(cars->flags[i] & CAR_ALWAYS_MOVE) && cars->y[i] == step->frogY
+        && std::max(x, end) >= step->frogX - CAR_MAX_DISTANCE_FROM_FROG && std::min(x, end) <= step->frogX + CAR_MAX_DISTANCE_FROM_FROG) {
+        return false;                                   // Friendly car waiting for the frog (CheckIfFrogIsClose)
+    }
+    int next = x + direction;
+    if (cars->xSpeedChange[i] == next) {
+        return false;                                   // Draws a new speed
+    }
+    return !((direction == 1 && next - cars->length[i] > step->width - 2) || (direction == -1 && next < 1 - cars->length[i]));
+}
+
+void StepCarsWord(const CARS* cars, const CAR_STEP* step, const unsigned long long* touch, unsigned long long* shift, unsigned long long* visit, int w) {
+    unsigned long long due = 0;
+    unsigned long long alone = 0;
+    int end = std::min(cars->count - w * 64, 64);
+    for (int j = 0; j < end; j++) {
+        int i = w * 64 + j;
+        if (step->dueBySpeed[cars->speed[i]]) {
+            due |= 1ULL << j;
+            if (CarShiftsAlone(cars, step, i)) alone |= 1ULL << j;
+        }
+    }
+    alone &= ~touch[w];
+    shift[w] = alone;
+    visit[w] = touch[w] | (due & ~alone);
+}
+
+void StepCarsScalar(const CARS* cars, const CAR_STEP* step, const unsigned long long* touch, unsigned long long* shift, unsigned long long* visit) {
+    for (int w = 0; w * 64 < cars->count; w++) {
+        StepCarsWord(cars, step, touch, shift, visit, w);
+    }
+}
+
+#ifdef CAR_KERNELS_X86
+__attribute__((target("sse2")))
+inline __m128i SelectSse2(__m128i mask, __m128i a, __m128i b) {
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));     // a where mask is set, else b
+}
+
+__attribute__((target("sse2")))
+void StepCarsSse2(const CARS* cars, const CAR_STEP* step, const unsigned long long* touch, unsigned long long* shift, unsigned long long* visit) {
+    int whole = cars->count / 64;
+    if (whole == 0) {
+        StepCarsWord(cars, step, touch, shift, visit, 0);      // Too few cars to fill a vector pass
+        return;
+    }
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi32(1);
+    const __m128i lanes = _mm_setr_epi32(0, 1, 2, 3);
+    const __m128i frogY = _mm_set1_epi32(step->frogY);
+    const __m128i frogLeft = _mm_set1_epi32(step->frogX - CAR_MAX_DISTANCE_FROM_FROG);
+    const __m128i frogRight = _mm_set1_epi32(step->frogX + CAR_MAX_DISTANCE_FROM_FROG);
+    const __m128i carried = _mm_set1_epi32(step->carried);
+    const __m128i rightEdge = _mm_set1_epi32(step->width - 2);
+    const __m128i waitingFlag = _mm_set1_epi32(CAR_WAITING);
+    const __m128i alwaysFlag = _mm_set1_epi32(CAR_ALWAYS_MOVE);
+    for (int w = 0; w < whole; w++) {
+        unsigned long long due = 0;
+        unsigned long long alone = 0;
+        for (int j = 0; j < 64; j += 4) {
+            int i = w * 64 + j;
+            __m128i speed = _mm_loadu_si128((const __m128i*)(cars->speed + i));
+            __m128i isDue = _mm_setzero_si128();
+            for (int k = 0; k < step->dueCount; k++) {
+                isDue = _mm_or_si128(isDue, _mm_cmpeq_epi32(speed, _mm_set1_epi32(step->dueSpeeds[k])));
+            }
+            int flagBytes;
+            memcpy(&flagBytes, cars->flags + i, sizeof(flagBytes));
+            __m128i flags = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(flagBytes), zero), zero);
+            __m128i x = _mm_loadu_si128((const __m128i*)(cars->x + i));
+            __m128i length = _mm_loadu_si128((const __m128i*)(cars->length + i));
+            __m128i direction = _mm_loadu_si128((const __m128i*)(cars->direction + i));
+            __m128i backward = _mm_srai_epi32(direction, 31);                                   // -1 where the car drives left
+            __m128i span = _mm_sub_epi32(_mm_xor_si128(_mm_sub_epi32(length, one), backward), backward);    // (length - 1) * direction
+            __m128i end = _mm_add_epi32(x, span);
+            __m128i low = SelectSse2(backward, end, x);
+            __m128i high = SelectSse2(backward, x, end);
+            __m128i nearFrog = _mm_and_si128(_mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)(cars->y + i)), frogY),
+                _mm_andnot_si128(_mm_or_si128(_mm_cmpgt_epi32(frogLeft, high), _mm_cmpgt_epi32(low, frogRight)), _mm_cmpeq_epi32(_mm_and_si128(flags, alwaysFlag), zero)));
+            __m128i next = _mm_add_epi32(x, direction);
+            __m128i change = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)(cars->xSpeedChange + i)), next);
+            __m128i leaves = SelectSse2(backward, _mm_cmpgt_epi32(_mm_sub_epi32(one, length), next), _mm_cmpgt_epi32(_mm_sub_epi32(next, length), rightEdge));
+            __m128i waiting = _mm_cmpgt_epi32(_mm_and_si128(flags, waitingFlag), zero);
+            __m128i isCarried = _mm_cmpeq_epi32(_mm_add_epi32(_mm_set1_epi32(i), lanes), carried);
+            __m128i stays = _mm_or_si128(_mm_or_si128(nearFrog, change), _mm_or_si128(_mm_or_si128(leaves, waiting), isCarried));
+            due |= (unsigned long long)_mm_movemask_ps(_mm_castsi128_ps(isDue)) << j;
+            alone |= (unsigned long long)_mm_movemask_ps(_mm_castsi128_ps(_mm_andnot_si128(stays, isDue))) << j;
+        }
+        alone &= ~touch[w];
+        shift[w] = alone;
+        visit[w] = touch[w] | (due & ~alone);
+    }
+    if (whole * 64 < cars->count) {
+        StepCarsWord(cars, step, touch, shift, visit, whole);
+    }
+}
+
+__attribute__((target("avx2")))
+void StepCarsAvx2(const CARS* cars, const CAR_STEP* step, const unsigned long long* touch, unsigned long long* shift, unsigned long long* visit) {
+    int whole = cars->count / 64;
+    if (whole == 0) {
+        StepCarsWord(cars, step, touch, shift, visit, 0);      // Too few cars to fill a vector pass
+        return;
+    }
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i frogY = _mm256_set1_epi32(step->frogY);
+    const __m256i frogLeft = _mm256_set1_epi32(step->frogX - CAR_MAX_DISTANCE_FROM_FROG);
+    const __m256i frogRight = _mm256_set1_epi32(step->frogX + CAR_MAX_DISTANCE_FROM_FROG);
+    const __m256i carried = _mm256_set1_epi32(step->carried);
+    const __m256i rightEdge = _mm256_set1_epi32(step->width - 2);
+    const __m256i waitingFlag = _mm256_set1_epi32(CAR_WAITING);
+    const __m256i alwaysFlag = _mm256_set1_epi32(CAR_ALWAYS_MOVE);
+    for (int w = 0; w < whole; w++) {
+        unsigned long long due = 0;
+        unsigned long long alone = 0;
+        for (int j = 0; j < 64; j += 8) {
+            int i = w * 64 + j;
+            __m256i speed = _mm256_loadu_si256((const __m256i*)(cars->speed + i));
+            __m256i isDue = _mm256_setzero_si256();
+            for (int k = 0; k < step->dueCount; k++) {
+                isDue = _mm256_or_si256(isDue, _mm256_cmpeq_epi32(speed, _mm256_set1_epi32(step->dueSpeeds[k])));
+            }
+            __m256i flags = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(cars->flags + i)));
+            __m256i x = _mm256_loadu_si256((const __m256i*)(cars->x + i));
+            __m256i length = _mm256_loadu_si256((const __m256i*)(cars->length + i));
+            __m256i direction = _mm256_loadu_si256((const __m256i*)(cars->direction + i));
+            __m256i backward = _mm256_srai_epi32(direction, 31);
+            __m256i end = _mm256_add_epi32(x, _mm256_sign_epi32(_mm256_sub_epi32(length, one), direction));
+            __m256i low = _mm256_min_epi32(x, end);
+            __m256i high = _mm256_max_epi32(x, end);
+            __m256i nearFrog = _mm256_and_si256(_mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i*)(cars->y + i)), frogY),
+                _mm256_andnot_si256(_mm256_or_si256(_mm256_cmpgt_epi32(frogLeft, high), _mm256_cmpgt_epi32(low, frogRight)), _mm256_cmpeq_epi32(_mm256_and_si256(flags, alwaysFlag), zero)));
+            __m256i next = _mm256_add_epi32(x, direction);
+            __m256i change = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i*)(cars->xSpeedChange + i)), next);
+            __m256i leaves = _mm256_blendv_epi8(_mm256_cmpgt_epi32(_mm256_sub_epi32(next, length), rightEdge), _mm256_cmpgt_epi32(_mm256_sub_epi32(one, length), next), backward);
+            __m256i waiting = _mm256_cmpgt_epi32(_mm256_and_si256(flags, waitingFlag), zero);
+            __m256i isCarried = _mm256_cmpeq_epi32(_mm256_add_epi32(_mm256_set1_epi32(i), lanes), carried);
+            __m256i stays = _mm256_or_si256(_mm256_or_si256(nearFrog, change), _mm256_or_si256(_mm256_or_si256(leaves, waiting), isCarried));
+            due |= (unsigned long long)(unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(isDue)) << j;
+            alone |= (unsigned long long)(unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_andnot_si256(stays, isDue))) << j;
+        }
+        alone &= ~touch[w];
+        shift[w] = alone;
+        visit[w] = touch[w] | (due & ~alone);
+    }
+    _mm256_zeroupper();                                 // Before the plain code of the last word (no AVX-SSE switch cost)
+    if (whole * 64 < cars->count) {
+        StepCarsWord(cars, step, touch, shift, visit, whole);
+    }
+}
+#endif
+
+const CAR_KERNELS CAR_KERNEL_SETS[] = {
+    { "scalar", StepCarsScalar },
+#ifdef CAR_KERNELS_X86
+    { "sse2", StepCarsSse2 },
+    { "avx2", StepCarsAvx2 },
+#endif
+};
+#define CAR_KERNEL_SET_COUNT int(sizeof(CAR_KERNEL_SETS) / sizeof(CAR_KERNEL_SETS[0]))
+
+CAR_KERNELS carKernels = CAR_KERNEL_SETS[0];
+
+bool CarKernelsSupported(const CAR_KERNELS* kernels) {
+#ifdef CAR_KERNELS_X86
+    if (strcmp(kernels->name, "sse2") == 0) return __builtin_cpu_supports("sse2");
+    if (strcmp(kernels->name, "avx2") == 0) return __builtin_cpu_supports("avx2");
+#endif
+    return true;
+}
+
+bool SelectCarKernels(const char* name) {
+    for (int k = CAR_KERNEL_SET_COUNT - 1; k >= 0; k--) {      // Without a name, the widest the CPU runs
+        if ((name == NULL || strcmp(name, CAR_KERNEL_SETS[k].name) == 0) && CarKernelsSupported(&CAR_KERNEL_SETS[k])) {
+            carKernels = CAR_KERNEL_SETS[k];
+            return true;
+        }
+    }
+    return false;
+}
+
+//------------------------------------------------
+//----------- ROADS & CARS FUNCTIONS -------------
+//------------------------------------------------
+
+int CarDelay(int carsTime, int speed, int carsTiming) {
+    int below = (carsTime - 1) / speed * speed;                 // Ticks until carsTime (counting down to 1, then back
+    if (below >= 1) {                                           // to carsTiming) is a multiple of speed again
+        return carsTime - below;
+    }
+    return carsTime + carsTiming % speed;
+}
+
+void UnscheduleCar(CARS* cars, int i) {
+    int slot = cars->wheelSlot[i];
+    if (slot < 0) {
+        return;
+    }
+    int next = cars->wheelNext[i];
+    int prev = cars->wheelPrev[i];
+    if (prev >= 0) cars->wheelNext[prev] = next;
+    else cars->wheelHead[slot] = next;
+    if (next >= 0) cars->wheelPrev[next] = prev;
+    cars->wheelSlot[i] = -1;
+}
+
+void ScheduleCar(CARS* cars, int i) {
+    UnscheduleCar(cars, i);
+    int slot = int((cars->wheelTick + cars->waitBySpeed[cars->speed[i]]) & cars->wheelMask);
+    int head = cars->wheelHead[slot];
+    cars->wheelNext[i] = head;
+    cars->wheelPrev[i] = -1;
+    if (head >= 0) cars->wheelPrev[head] = i;
+    cars->wheelHead[slot] = i;
+    cars->wheelSlot[i] = slot;
+}
+
+void RelinkWheel(CARS* cars) {
+    for (int slot = 0; slot <= cars->wheelMask; slot++) {
+        cars->wheelHead[slot] = -1;             // Slots from wheelSlot alone: the order within a slot never matters
+    }
+    for (int i = 0; i < cars->count; i++) {
+        int slot = cars->wheelSlot[i];
+        if (slot >= 0) {
+            int head = cars->wheelHead[slot];
+            cars->wheelNext[i] = head;
+            cars->wheelPrev[i] = -1;
+            if (head >= 0) cars->wheelPrev[head] = i;
+            cars->wheelHead[slot] = i;
+        }
+    }
+}
+
+void TouchCellsAround(CARS* cars, OCCUPANCY* occupancy, int y, int x) {
+    for (int row = y - 1; row <= y + 1; row++) {        // Cars under the cells a frog or a stork drew over
+        for (int column = x - 1; column <= x + 1; column++) {
+            int car = CarOnCell(occupancy, row, column);
+            if (car >= 0) {
+                TouchCar(cars, car);
+            }
+        }
+    }
+}
+
+int AddCar(CARS* cars, RNG* rng, int y, int width, int slot, int slots, int direction, int carLength, int carSpeed, int carMovingColor, int carStopColor) {
+    if (cars->count == cars->capacity) {
+        return -1;
+    }
+    int i = cars->count++;
+    int span = (width - 2) / slots;                     // The lane is cut in slots, a car in each, so they don't overlap
+    cars->y[i] = y;
+    cars->x[i] = Random(rng, std::max(span - carLength, 1)) + 1 + slot * span;
+    cars->length[i] = Random(rng, carLength) + 1;
+    cars->direction[i] = (direction != 0) ? direction : ((Random(rng, 2) == 0) ? 1 : -1);     // A lane drives one way
+    cars->speed[i] = Random(rng, carSpeed) + 1;
+    cars->xSpeedChange[i] = Random(rng, width - 2 - carLength) + 1;
+    cars->flags[i] = (Random(rng, 2) == 1) ? CAR_ALWAYS_MOVE : 0;
+    if (cars->flags[i] & CAR_ALWAYS_MOVE) cars->color[i] = carMovingColor;
+    else  cars->color[i] = carStopColor;
+    cars->wheelSlot[i] = -1;
+    TouchCar(cars, i);                      // Drawn and scheduled by the next MoveCars
+    return i;
+}
+
+CARS* InitCars(ARENA* arena, WIN* win, RNG* rng, int roadPositions[], int carsAndRoadsCount, int carsPerLane, int capacity, int carLength, int carSpeed, int carMovingColor, int carStopColor, char carSign) {
+    CARS* cars = ArenaNew<CARS>(arena);
+    cars->count = 0;
+    cars->capacity = capacity;
+    cars->x = ArenaArray<int>(arena, capacity);
+    cars->y = ArenaArray<int>(arena, capacity);
+    cars->length = ArenaArray<int>(arena, capacity);
+    cars->direction = ArenaArray<int>(arena, capacity);
+    cars->speed = ArenaArray<int>(arena, capacity);
+    cars->xSpeedChange = ArenaArray<int>(arena, capacity);
+    cars->flags = ArenaArray<unsigned char>(arena, capacity);
+    cars->color = ArenaArray<unsigned char>(arena, capacity);
+    cars->maxSpeed = carSpeed;
+    cars->dueBySpeed = ArenaArray<unsigned char>(arena, carSpeed + 1);
+    cars->dueSpeeds = ArenaArray<int>(arena, carSpeed);
+    cars->dense = carsPerLane == 1;
+    cars->sign = carSign;
+    int slots = 1;
+    while (slots < 2 * carSpeed) {
+        slots *= 2;                         // A car waits at most 2 * speed - 1 ticks (see CarDelay)
+    }
+    cars->wheelHead = ArenaArray<int>(arena, slots);
+    for (int slot = 0; slot < slots; slot++) {
+        cars->wheelHead[slot] = -1;
+    }
+    cars->wheelMask = slots - 1;
+    cars->wheelTick = 0;
+    cars->wheelNext = ArenaArray<int>(arena, capacity);
+    cars->wheelPrev = ArenaArray<int>(arena, capacity);
+    cars->wheelSlot = ArenaArray<int>(arena, capacity);
+    cars->waitBySpeed = ArenaArray<int>(arena, carSpeed + 1);
+    cars->words = (capacity + 63) / 64;
+    cars->hash = 0;
+    cars->touch = ArenaArray<unsigned long long>(arena, cars->words);
+    cars->visit = ArenaArray<unsigned long long>(arena, cars->words);
+    cars->shift = ArenaArray<unsigned long long>(arena, cars->words);
+    memset(cars->touch, 0, sizeof(unsigned long long) * cars->words);
+
+    for (int i = 0; i < carsAndRoadsCount; i++) {
+        int first = AddCar(cars, rng, roadPositions[i], win->width, 0, carsPerLane, 0, carLength, carSpeed, carMovingColor, carStopColor);
+        for (int k = 1; k < carsPerLane; k++) {
+            AddCar(cars, rng, roadPositions[i], win->width, k, carsPerLane, cars->direction[first], carLength, carSpeed, carMovingColor, carStopColor);
+        }
+    }
+    return cars;
+}
+
+void RemoveCar(CARS* cars, FROG* frog, OCCUPANCY* occupancy, int i) {
+    int last = --cars->count;               // The last car takes the free slot
+    UnscheduleCar(cars, i);
+    cars->hash ^= CarKey(cars, i);
+    if (i == last) {
+        return;
+    }
+    UnscheduleCar(cars, last);
+    cars->hash ^= CarKey(cars, last);
+    TouchCar(cars, i);                      // Scheduled again under its new index (touch bits >= count are dropped)
+    cars->x[i] = cars->x[last];
+    cars->y[i] = cars->y[last];
+    cars->length[i] = cars->length[last];
+    cars->direction[i] = cars->direction[last];
+    cars->speed[i] = cars->speed[last];
+    cars->xSpeedChange[i] = cars->xSpeedChange[last];
+    cars->flags[i] = cars->flags[last];
+    cars->color[i] = cars->color[last];
+    int row = OccupancyRow(occupancy, cars->y[i]);
+    occupancy->carSlot[i] = occupancy->carSlot[last];
+    occupancy->lane[row * occupancy->perLane + occupancy->carSlot[i]] = i;
+    cars->hash ^= CarKey(cars, i);          // Its key changes with the index
+    if (frog != NULL && frog->carringCar == last) {
+        frog->carringCar = i;
+    }
+}
+
+int CheckIfFrogIsOnCar(FROG* frog, OCCUPANCY* occupancy) {
+    return CarOnCell(occupancy, frog->y, frog->x);          // Index of the car under the frog (-1 if none)
+}
+
+bool CheckIfFrogIsClose(FROG* frog, CARS* cars, int i) {
+    if ((cars->flags[i] & CAR_ALWAYS_MOVE) || frog->y != cars->y[i]) {
+        return true;
+    }
+    // Check if the frog is close to the car (this car, not the others of the lane)
+    int end = cars->x[i] + (cars->length[i] - 1) * cars->direction[i];
+    return std::max(cars->x[i], end) < frog->x - CAR_MAX_DISTANCE_FROM_FROG || std::min(cars->x[i], end) > frog->x + CAR_MAX_DISTANCE_FROM_FROG;
+}
+
+void ResetCar(FROG* frog, CARS* cars, int i, RNG* rng, int width, int carLength, int carSpeed, int carMovingColor, int carStopColor) {
+    if (frog->carringCar == i) {
+        cars->speed[i] = Random(rng, carSpeed) + 1;                         // The same car when the frog is inside
+        cars->xSpeedChange[i] = Random(rng, width - 2 - carLength) + 1;
+    }
+    else {
+        cars->length[i] = Random(rng, carLength) + 1;
+        cars->speed[i] = Random(rng, carSpeed) + 1;
+        cars->xSpeedChange[i] = Random(rng, width - 2 - carLength) + 1;       // New cars with new parameters when frog is outside
+        cars->flags[i] = (Random(rng, 2) == 1) ? CAR_ALWAYS_MOVE : 0;
+        if (cars->flags[i] & CAR_ALWAYS_MOVE) cars->color[i] = carMovingColor;
+        else  cars->color[i] = carStopColor;
+    }
+    cars->x[i] = (cars->direction[i] == 1) ? 0 - cars->length[i] : width + cars->length[i] - 1;     // Change the position of the car (depends on car direction)
+}
+
+void DrawCars(WIN* win, CARS* cars, int i) {
+    if (!win->renderer->draws) return;       // Headless, nothing to draw
+    int row = cars->y[i] - win->scrollY;
+    if (row < 1 || row > win->height - 2) return;      // Road outside the viewport
+    for (int j = 0; j < cars->length[i]; j++) {
+        int newX = cars->x[i] + j * cars->direction[i];             // Draw the car on the new position (depends on car direction)
+        if (newX > 0 && newX < win->width - 1) {
+            win->renderer->put(win, row, newX, cars->sign, cars->color[i]);
+        }
+    }
+}
+
+void EraseCars(WIN* win, CARS* cars, int i) {
+    if (!win->renderer->draws) return;
+    int row = cars->y[i] - win->scrollY;
+    if (row < 1 || row > win->height - 2) return;
+    for (int j = 0; j < cars->length[i]; j++) {
+        int newX = cars->x[i] + j * cars->direction[i];             // Erase the last position of the car
+        if (newX > 0 && newX < win->width - 1) {
+            win->renderer->put(win, row, newX, ' ', ROAD_COLOR);
+        }
+    }
+}
+
+void MoveCars(WIN* win, CARS* cars, RNG* rng, TIMER* timer, FROG* frog, OCCUPANCY* occupancy, int carLength, int carSpeed, int carMoveColor, int carStopColor) {
+    int count = cars->count;
+    int width = win->width;
+    bool draw = win->renderer->draws;           // Headless rounds skip the draw calls
+    int* x = cars->x;
+    int* speed = cars->speed;
+    unsigned char* due = cars->dueBySpeed;
+    unsigned long long hash = cars->hash;       // In a register, the byte stores to the cars could alias the field
+
+    int dueCount = 0;
+    for (int s = 1; s <= cars->maxSpeed; s++) {
+        due[s] = (timer->carsTime % s == 0);        // Which speeds move this tick
+        if (due[s]) cars->dueSpeeds[dueCount++] = s;
+        if (!cars->dense) cars->waitBySpeed[s] = CarDelay(timer->carsTime, s, timer->carsTiming);
+    }
+
+    unsigned long long* visit = cars->visit;    // Only the cars that move or were touched, the rest stay as they are
+    int words = (count + 63) / 64;
+    if (cars->dense) {
+        CAR_STEP step = { due, cars->dueSpeeds, dueCount, frog->x, frog->y, frog->carried ? frog->carringCar : -1, width };
+        carKernels.stepCars(cars, &step, cars->touch, cars->shift, visit);
+        for (int w = 0; w < words; w++) {
+            cars->touch[w] = 0;
+            for (unsigned long long bits = cars->shift[w]; bits != 0; bits &= bits - 1) {
+                int i = w * 64 + __builtin_ctzll(bits);       // Alone in its lane, so the order does not matter
+                if (draw) EraseCars(win, cars, i);
+                unsigned long long place = CarPlace(cars, i);
+                ShiftCar(occupancy, cars, i);
+                hash ^= CarMoveKey(cars, i, place);
+                if (draw) DrawCars(win, cars, i);
+            }
+        }
+    }
+    else {
+        for (int w = 0; w < words; w++) {
+            visit[w] = cars->touch[w];
+            cars->touch[w] = 0;
+        }
+        int slot = int(cars->wheelTick & cars->wheelMask);
+        for (int i = cars->wheelHead[slot]; i >= 0; i = cars->wheelNext[i]) {
+            cars->wheelSlot[i] = -1;
+            visit[i >> 6] |= 1ULL << (i & 63);
+        }
+        cars->wheelHead[slot] = -1;
+    }
+
+    for (int w = 0; w < words; w++) {           // In index order, like a pass over every car, so the same random numbers
+        for (unsigned long long bits = visit[w]; bits != 0; bits &= bits - 1) {
+            int i = w * 64 + __builtin_ctzll(bits);
+            if (i >= count) break;
+            unsigned long long place = CarPlace(cars, i);   // As the hash has it, rekeyed at the end
+            if (cars->flags[i] & CAR_WAITING) {
+                unsigned long long rest = CarRestKey(cars, i);
+                if (!EnterLane(occupancy, cars, i)) {
+                    if (!cars->dense) ScheduleCar(cars, i);
+                    continue;                     // Still behind the entry (off the board, nothing to draw)
+                }
+                hash ^= rest ^ CarRestKey(cars, i);
+            }
+            if (draw) EraseCars(win, cars, i);    // Erase the cars
+            if (due[speed[i]] && CheckIfFrogIsClose(frog, cars, i) && CanShiftCar(occupancy, cars, i)) {     // Move cars if the time is right
+                ShiftCar(occupancy, cars, i);                                                      // and frog far enough from the friendly cars
+            }
+            if (cars->xSpeedChange[i] == x[i]) {                    // Change the speed of the car during the game
+                hash ^= CarRestKey(cars, i);
+                speed[i] = Random(rng, carSpeed) + 1;
+                hash ^= CarRestKey(cars, i);
+            }
+
+            if (frog->carried && frog->carringCar == i && due[speed[i]] && CanShiftCar(occupancy, cars, i)) {
+                ShiftCar(occupancy, cars, i);               // Move the car when the frog inside   
+                frog->x = x[i];
+            }
+
+            if (((cars->direction[i] == 1 && x[i] - cars->length[i] > width - 2)
+                || (cars->direction[i] == -1 && x[i] < 1 - cars->length[i]))
+                && LaneCar(occupancy, OccupancyRow(occupancy, cars->y[i]), 0) == i) {    // A short car leaves after the long one ahead
+                MarkCar(occupancy, cars, i, false);
+                hash ^= CarRestKey(cars, i);
+                ResetCar(frog, cars, i, rng, width, carLength, carSpeed, carMoveColor, carStopColor);       // New cars after they leave the border
+                ReenterLane(occupancy, cars, i);  // at the back of the lane
+                hash ^= CarRestKey(cars, i);
+            }
+            if (draw) DrawCars(win, cars, i);     // Draw the cars
+            hash ^= CarMoveKey(cars, i, place);
+
+            if (!cars->dense) ScheduleCar(cars, i);     // Next tick it moves at its (maybe new) speed
+            if (cars->xSpeedChange[i] == x[i]) {
+                TouchCar(cars, i);                // Draws a new speed every tick it stays on the cell
+            }
+        }
+    }
+    cars->hash = hash;
+    cars->wheelTick++;
+}
+
+bool CarColision(FROG* frog, CARS* cars, OCCUPANCY* occupancy) {
+    int i = CarOnCell(occupancy, frog->y, frog->x);         // Only the frog's row is looked up
+    return i >= 0 && (cars->flags[i] & CAR_ALWAYS_MOVE);   // Check collisions with red (enemy) cars
+}
+
+//------------------------------------------------
+//----------------  FROG FUNCTIONS ---------------
+//------------------------------------------------
+
+bool CheckFrogStartPosition(MAP* map, int x, int y) {
+    if (MapCell(map, y, x) == OBSTACLE || MapCell(map, y, x) == COIN) {     // Frog can't start from obstacle or coin
+        return false;
+    }
+    return true;
+}
+
+FROG* InitFrog(ARENA* arena, WIN* w, RNG* rng, int frogColor, char frogSign, int maxMoves, MAP* map) {
+    FROG* frog = ArenaNew<FROG>(arena);
+    frog->win = w;
+    frog->y = w->height - 2;
+    int free = 0;
+    for (int x = 1; x < w->width - 1; x++) {
+        if (CheckFrogStartPosition(map, x, frog->y)) free++;
+    }
+    if (free == 0) {
+        frog->x = Random(rng, w->width - 2) + 1;        // Start row full of obstacles and coins,
+        ReplaceMapCell(map, frog->y, frog->x, GRASS);   // make room for the frog
+    }
+    else {
+        int k = Random(rng, free);                      // k-th free cell of the start row, no redraws
+        for (frog->x = 1; !CheckFrogStartPosition(map, frog->x, frog->y) || k-- > 0; frog->x++) {}
+    }
+    frog->points = 0;
+    frog->remainingMoves = maxMoves;
+    frog->maxMoves = maxMoves;
+    frog->color = frogColor;
+    frog->sign = frogSign;
+    frog->carried = false;
+    frog->lastMoveTime = -FROG_MOVE_INTERVAL;      // Can move from the first tick
+    frog->carringCar = -1;
+    frog->startY = frog->y;
+    frog->distance = 0;
+    return frog;
+}
+
+void DrawFrog(FROG* frog) {
+    if (!frog->win->renderer->draws) return;
+    frog->win->renderer->put(frog->win, frog->y - frog->win->scrollY, frog->x, frog->sign, frog->color);        // Draw frog
+}
+
+void EraseFrog(FROG* frog, MAP* map) {
+    if (!frog->win->renderer->draws) return;
+    int mapY = frog->y;
+    int mapX = frog->x;
+
+    int color = 0;
+    char ch = ' ';
+    switch (MapCell(map, mapY, mapX)) {
+    case GRASS:     // Grass
+        color = GRASS_COLOR;
+        break;
+    case ROAD:      // Road
+        color = ROAD_COLOR;
+        break;
+    case DESTINATION:       // Destination
+        color = DESTINATION_COLOR;
+        break;
+    case OBSTACLE:      // Obstacle
+        color = OBSTACLE_COLOR;
+        ch = OBSTACLE_SIGN;
+        break;
+    case COIN:          // Coin
+        color = GRASS_COLOR;
+        break;
+    }
+
+    frog->win->renderer->put(frog->win, mapY - frog->win->scrollY, mapX, ch, color);
+}
+
+bool FrogOnDestination(FROG* frog, MAP* map) {
+    if (frog->x < 1 || frog->x > map->cols - 2) {
+        return false;                               // Carried off the board
+    }
+    return MapCell(map, frog->y, frog->x) == DESTINATION;     // Never in endless rounds
+}
+
+bool CanMove(int lastMoveTime, int currentTime, int interval) {
+    return (currentTime - lastMoveTime >= interval);      // True if timeDiff >= interval (game time in ms)
+}
+
+void CheckFrogMove(WIN* playwin, FROG* frog, TIMER* timer, MAP* map, int newX, int newY) {
+    if (newX > 0 && newX < playwin->width - 1 && newY > playwin->scrollY && newY < playwin->scrollY + playwin->height - 1) {
+        if (MapCell(map, newY, newX) != OBSTACLE) {
+            if (MapCell(map, newY, newX) == COIN) {         // Check the type of the new position
+                ChangeMapCell(map, newY, newX, GRASS);        // and allow or block the move
+                frog->points++;
+            }
+            EraseFrog(frog, map);
+            frog->x = newX;
+            frog->y = newY;
+            if (frog->startY - newY > frog->distance) {
+                frog->distance = frog->startY - newY;
+            }
+            frog->remainingMoves--;             // Change the parameters of the frog and stats if the move is possible
+            frog->lastMoveTime = timer->elapsed;
+            DrawFrog(frog);
+        }
+    }
+}
+
+void FrogAndCarInteraction(WIN* playwin, FROG* frog, CARS* cars, OCCUPANCY* occupancy, int carStopColor, int carFrogColor) {
+    if (frog->carried && frog->x > 0 && frog->x <= playwin->width - 2) {
+        RecolorCar(cars, frog->carringCar, carStopColor);
+        frog->carried = false;
+        frog->carringCar = -1;             // Frog exit the car
+        DrawFrog(frog);
+        return;
+    }
+    else if (!frog->carried) {
+        int i = CheckIfFrogIsOnCar(frog, occupancy);
+        if (i >= 0) {            // Frog enetr the car
+            frog->carried = true;
+            frog->carringCar = i;
+            RecolorCar(cars, i, carFrogColor);
+        }
+        return;
+    }
+}
+
+//------------------------------------------------
+//----------------  INPUT FUNCTIONS --------------
+//------------------------------------------------
+
+void InitKeyboardInput(INPUT* input) {
+    input->keys = NULL;
+    input->tickEndNs = 0;
+    input->bufferSize = INPUT_BUFFER;
+    input->pendingCount = 0;
+    input->shownNs = 0;
+    input->lastLatency = 0;
+    input->maxLatency = 0;
+    input->latencySum = 0;
+    input->latencyCount = 0;
+    input->scriptTicks = NULL;
+    input->scriptKeys = NULL;
+    input->scriptCount = 0;
+    input->scriptPos = 0;
+    input->tick = 0;
+    input->hashTicks = NULL;
+    input->hashes = NULL;
+    input->hashCount = 0;
+    input->hashPos = 0;
+    input->hashesChecked = 0;
+    input->desyncTick = -1;
+    input->record = NULL;
+    input->recordTick = 0;
+    input->randomPolicy = false;
+    SeedRandom(&input->policyRng, POLICY_SEED);
+}
+
+int ParseScriptKey(const char* name) {
+    if (strcmp(name, "UP") == 0) return KEY_UP;
+    if (strcmp(name, "DOWN") == 0) return KEY_DOWN;
+    if (strcmp(name, "LEFT") == 0) return KEY_LEFT;
+    if (strcmp(name, "RIGHT") == 0) return KEY_RIGHT;
+    if (strcmp(name, "SPACE") == 0) return ' ';
+    return ERR;
+}
+
+bool LoadScript(const char* filename, INPUT* input) {
+    FILE* file = fopen(filename, "r");
+    if (file == NULL) {
+        return false;
+    }
+    input->scriptTicks = new int[SCRIPT_MAX_EVENTS];
+    input->scriptKeys = new int[SCRIPT_MAX_EVENTS];
+    input->scriptCount = 0;
+
+    int tick;
+    char name[16];
+    while (input->scriptCount < SCRIPT_MAX_EVENTS && fscanf(file, "%d %15s", &tick, name) == 2) {     // "<tick> <UP|DOWN|LEFT|RIGHT|SPACE>" per line
+        int key = ParseScriptKey(name);
+        if (key != ERR) {
+            input->scriptTicks[input->scriptCount] = tick;
+            input->scriptKeys[input->scriptCount] = key;
+            input->scriptCount++;
+        }
+    }
+    fclose(file);
+    return true;
+}
+
+void RecordKey(INPUT* input, int key);
+long long MonotonicNs();
+
+void PushKey(KEY_QUEUE* queue, int key, long long ns) {
+    unsigned tail = queue->tail.load(memory_order_relaxed);
+    if (tail - queue->head.load(memory_order_acquire) == KEY_QUEUE_SIZE) {
+        queue->dropped.fetch_add(1, memory_order_relaxed);         // Game loop stalled, the older keys stay
+        return;
+    }
+    queue->events[tail % KEY_QUEUE_SIZE].key = key;
+    queue->events[tail % KEY_QUEUE_SIZE].ns = ns;
+    queue->tail.store(tail + 1, memory_order_release);             // Publish the event once it is written
+}
+
+bool PopKey(KEY_QUEUE* queue, long long before, KEY_EVENT* event) {
+    unsigned head = queue->head.load(memory_order_relaxed);
+    if (head == queue->tail.load(memory_order_acquire)) {
+        return false;
+    }
+    *event = queue->events[head % KEY_QUEUE_SIZE];
+    if (event->ns >= before) {
+        return false;                   // Pressed after this tick ended, left for the next one
+    }
+    queue->head.store(head + 1, memory_order_release);
+    return true;
+}
+
+void KeyReader(KEY_QUEUE* queue) {
+    unsigned char bytes[64];
+    int escape = 0;                     // Bytes of an arrow key seen so far (ESC [ A or ESC O A)
+    while (queue->running.load(memory_order_relaxed)) {
+        pollfd poller = { queue->fd, POLLIN, 0 };
+        if (poll(&poller, 1, KEY_POLL_MS) <= 0) {
+            continue;
+        }
+        long long ns = MonotonicNs();                       // Stamped as soon as the bytes arrive
+        ssize_t count = read(queue->fd, bytes, sizeof(bytes));
+        for (ssize_t i = 0; i < count; i++) {
+            int c = bytes[i];
+            if (escape == 1) {
+                escape = (c == '[' || c == 'O') ? 2 : 0;
+            }
+            else if (escape == 2) {
+                escape = 0;
+                if (c == 'A') PushKey(queue, KEY_UP, ns);
+                else if (c == 'B') PushKey(queue, KEY_DOWN, ns);
+                else if (c == 'C') PushKey(queue, KEY_RIGHT, ns);
+                else if (c == 'D') PushKey(queue, KEY_LEFT, ns);
+            }
+            else if (c == 27) {
+                escape = 1;
+            }
+            else if (c == ' ') {
+                PushKey(queue, ' ', ns);                    // Other keys do nothing in the game
+            }
+            else if (c == 'r' || c == 'R') {
+                queue->rewinds.fetch_add(1, memory_order_relaxed);     // Out of band, not a move of any tick
+            }
+        }
+    }
+}
+
+void StartKeyReader(KEY_QUEUE* queue, int fd) {
+    queue->head.store(0);
+    queue->tail.store(0);
+    queue->dropped.store(0);
+    queue->rewinds.store(0);
+    queue->fd = fd;
+    queue->running.store(true);
+    queue->reader = thread(KeyReader, queue);       // curses is not thread safe, so the reader works on the raw terminal
+}
+
+void StopKeyReader(KEY_QUEUE* queue) {
+    queue->running.store(false);
+    queue->reader.join();                           // Returns within KEY_POLL_MS
+}
+
+void TakeKeys(INPUT* input) {
+    KEY_EVENT event;
+    while (PopKey(input->keys, input->tickEndNs, &event)) {        // Everything pressed before the end of this tick
+        if (input->pendingCount <= input->bufferSize) {
+            input->pending[input->pendingCount++] = event;         // A key for this tick and the buffered moves, the rest is lost
+        }
+    }
+}
+
+const int POLICY_KEYS[] = { ERR, ERR, KEY_UP, KEY_UP, KEY_UP, KEY_DOWN, KEY_LEFT, KEY_RIGHT, ' ' };     // Mostly forward
+#define POLICY_KEYS_COUNT 9
+
+int ReadKey(INPUT* input, bool canMove) {
+    int key = ERR;
+    if (input->keys != NULL) {
+        TakeKeys(input);                        // Keyboard
+        if (!canMove) {
+            input->pendingCount = min(input->pendingCount, input->bufferSize);     // Played when the break is over
+            return ERR;
+        }
+        if (input->pendingCount > 0) {
+            key = input->pending[0].key;
+            if (input->shownNs == 0) {
+                input->shownNs = input->pending[0].ns;      // Latency is taken when this tick's frame is flushed
+            }
+            input->pendingCount--;
+            memmove(input->pending, input->pending + 1, input->pendingCount * sizeof(KEY_EVENT));
+        }
+    }
+    else if (input->randomPolicy) {
+        key = POLICY_KEYS[Random(&input->policyRng, POLICY_KEYS_COUNT)];     // Random frog
+    }
+    else {
+        while (input->scriptPos < input->scriptCount && input->scriptTicks[input->scriptPos] < input->tick) {
+            input->scriptPos++;                 // Skip events of past ticks
+        }
+        if (input->scriptPos < input->scriptCount && input->scriptTicks[input->scriptPos] == input->tick) {
+            key = input->scriptKeys[input->scriptPos++];     // Scripted key for this tick
+        }
+    }
+    if (!canMove) {
+        return ERR;                             // Scripted keys during the break are lost
+    }
+    if (input->record != NULL && key != ERR) {
+        RecordKey(input, key);                  // Only keys the game used end up in the replay, so it plays the same unbuffered
+    }
+    return key;
+}
+
+void ClearInput(INPUT* input) {
+    if (input->keys != NULL || input->randomPolicy) {       // Keys left on the keyboard belong to the next ticks
+        return;
+    }
+    while (input->scriptPos < input->scriptCount && input->scriptTicks[input->scriptPos] == input->tick) {
+        input->scriptPos++;
+    }
+}
+
+void RewindInput(INPUT* input) {
+    input->scriptPos = 0;           // Scripts replay from the start of every round
+    input->tick = 0;
+    input->hashPos = 0;
+    input->hashesChecked = 0;
+    input->desyncTick = -1;
+    input->recordTick = 0;
+    input->pendingCount = 0;
+    input->shownNs = 0;
+    input->lastLatency = 0;
+    input->maxLatency = 0;
+    input->latencySum = 0;
+    input->latencyCount = 0;
+}
+
+void NoteLatency(INPUT* input, long long now) {
+    if (input->shownNs == 0) {
+        return;
+    }
+    input->lastLatency = now - input->shownNs;              // Key pressed to frame on the terminal
+    input->maxLatency = max(input->maxLatency, input->lastLatency);
+    input->latencySum += input->lastLatency;
+    input->latencyCount++;
+    input->shownNs = 0;
+}
+
+void SeedPolicy(INPUT* input, unsigned long long seed) {
+    SeedRandom(&input->policyRng, seed ^ POLICY_SEED);     // The random frog plays the same in every run of a seed
+}
+
+void FreeInput(INPUT* input) {
+    delete[] input->scriptTicks;
+    delete[] input->scriptKeys;
+    delete[] input->hashTicks;
+    delete[] input->hashes;
+    input->scriptTicks = NULL;          // Back to the keyboard
+    input->scriptKeys = NULL;
+    input->scriptCount = 0;
+    input->hashTicks = NULL;
+    input->hashes = NULL;
+    input->hashCount = 0;
+}
+
+//------------------------------------------------
+//----------------  REPLAY FUNCTIONS -------------
+//------------------------------------------------
+
+const int REPLAY_KEYS[] = { ERR, KEY_UP, KEY_DOWN, KEY_LEFT, KEY_RIGHT, ' ' };     // Key codes stored in a replay
+#define REPLAY_KEYS_COUNT 6
+
+void WriteVarint(FILE* file, unsigned long long value) {
+    while (value >= 0x80) {
+        fputc(int(value & 0x7F) | 0x80, file);        // 7 bits per byte, high bit = more bytes follow
+        value >>= 7;
+    }
+    fputc(int(value), file);
+}
+
+bool ReadVarint(const unsigned char** data, const unsigned char* end, unsigned long long* value) {
+    *value = 0;
+    for (int shift = 0; *data < end && shift < 64; shift += 7) {
+        unsigned char byte = *(*data)++;
+        *value |= (unsigned long long)(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool StartRecording(INPUT* input, const char* filename, unsigned long long seed, CONFIG* config) {
+    input->record = fopen(filename, "wb");
+    if (input->record == NULL) {
+        return false;
+    }
+    fwrite(REPLAY_MAGIC, 1, 4, input->record);             // Header: magic, seed and the config of the round
+    WriteVarint(input->record, seed);
+    WriteVarint(input->record, config->rows);
+    WriteVarint(input->record, config->cols);
+    WriteVarint(input->record, config->carsAndRoads);
+    WriteVarint(input->record, config->carSpeed);
+    WriteVarint(input->record, config->carLength);
+    WriteVarint(input->record, config->timeToStork);
+    WriteVarint(input->record, config->frogMoves);
+    WriteVarint(input->record, config->storks);
+    WriteVarint(input->record, config->endless ? 1 : 0);
+    WriteVarint(input->record, config->carsPerLane);
+    fputc(config->frogSign, input->record);
+    fputc(config->carSign, input->record);
+    fflush(input->record);
+    input->recordTick = 0;
+    return true;
+}
+
+void RecordKey(INPUT* input, int key) {
+    for (int code = 1; code < REPLAY_KEYS_COUNT; code++) {
+        if (REPLAY_KEYS[code] == key) {
+            WriteVarint(input->record, ((unsigned long long)(input->tick - input->recordTick) << REPLAY_KEY_BITS) | code);   // Usually one byte per key
+            fflush(input->record);                          // Keep the replay usable if the game crashes
+            input->recordTick = input->tick;
+            return;
+        }
+    }
+}
+
+void RecordHash(INPUT* input, unsigned long long hash) {
+    WriteVarint(input->record, ((unsigned long long)(input->tick - input->recordTick) << REPLAY_KEY_BITS) | REPLAY_HASH_CODE);
+    for (int i = 0; i < 8; i++) {
+        fputc(int(hash >> (8 * i)) & 0xFF, input->record);      // Flushed with the next key
+    }
+    input->recordTick = input->tick;
+}
+
+void CheckHash(INPUT* input, unsigned long long hash) {
+    while (input->hashPos < input->hashCount && input->hashTicks[input->hashPos] < input->tick) {
+        input->hashPos++;
+    }
+    if (input->hashPos == input->hashCount || input->hashTicks[input->hashPos] != input->tick) {
+        return;
+    }
+    if (input->hashes[input->hashPos++] != hash && input->desyncTick < 0) {
+        input->desyncTick = input->tick;            // The first tick that played differently from the recording
+    }
+    input->hashesChecked++;
+}
+
+void StopRecording(INPUT* input) {
+    if (input->record != NULL) {
+        fclose(input->record);
+        input->record = NULL;
+    }
+}
+
+bool LoadReplay(const char* filename, INPUT* input, unsigned long long* seed, CONFIG* config) {
+    FILE* file = fopen(filename, "rb");
+    if (file == NULL) {
+        return false;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    unsigned char* buffer = new unsigned char[size > 0 ? size : 1];
+    bool ok = size > 4 && fread(buffer, 1, size, file) == (size_t)size && memcmp(buffer, REPLAY_MAGIC, 4) == 0;
+    fclose(file);
+
+    const unsigned char* data = buffer + 4;
+    const unsigned char* end = buffer + size;
+    unsigned long long fields[11];
+    for (int i = 0; ok && i < 11; i++) {
+        ok = ReadVarint(&data, end, &fields[i]);
+    }
+    if (ok && end - data >= 2) {
+        *seed = fields[0];
+        config->rows = int(fields[1]);
+        config->cols = int(fields[2]);
+        config->carsAndRoads = int(fields[3]);
+        config->carSpeed = int(fields[4]);
+        config->carLength = int(fields[5]);
+        config->timeToStork = int(fields[6]);
+        config->frogMoves = int(fields[7]);
+        config->storks = int(fields[8]);
+        config->endless = fields[9] != 0;
+        config->carsPerLane = int(fields[10]);
+        config->frogSign = char(*data++);
+        config->carSign = char(*data++);
+
+        input->scriptTicks = new int[end - data + 1];       // At least one byte per event
+        input->scriptKeys = new int[end - data + 1];
+        input->scriptCount = 0;
+        input->hashTicks = new int[(end - data) / 9 + 1];   // Nine bytes per state hash
+        input->hashes = new unsigned long long[(end - data) / 9 + 1];
+        input->hashCount = 0;
+        unsigned long long event;
+        int tick = 0;
+        while (data < end && ReadVarint(&data, end, &event)) {
+            int code = int(event & ((1 << REPLAY_KEY_BITS) - 1));
+            tick += int(event >> REPLAY_KEY_BITS);
+            if (code == REPLAY_HASH_CODE) {
+                if (end - data < 8) {
+                    break;                                  // Cut short by a crash
+                }
+                unsigned long long hash = 0;
+                for (int i = 0; i < 8; i++) {
+                    hash |= (unsigned long long)data[i] << (8 * i);
+                }
+                data += 8;
+                input->hashTicks[input->hashCount] = tick;
+                input->hashes[input->hashCount] = hash;
+                input->hashCount++;
+            }
+            else if (code > 0 && code < REPLAY_KEYS_COUNT) {
+                input->scriptTicks[input->scriptCount] = tick;
+                input->scriptKeys[input->scriptCount] = REPLAY_KEYS[code];
+                input->scriptCount++;
+            }
+        }
+    }
+    else {
+        ok = false;
+    }
+    delete[] buffer;
+    return ok;
+}
+
+//------------------------------------------------
+//-------------  FROG MOVEMENT FUNCTIONS ---------
+//------------------------------------------------
+
+void FrogMovement(WIN* playwin, FROG* frog, CARS* cars, TIMER* timer, INPUT* input, OCCUPANCY* occupancy, MAP* map, int carStopColor, int carFrogColor) {
+    bool canMove = CanMove(frog->lastMoveTime, timer->elapsed, FROG_MOVE_INTERVAL);       // Break between moves
+    int ch = ReadKey(input, canMove);
+
+    if (!canMove) {
+        return;
+    }
+
+    if (ch == ' ') {
+        FrogAndCarInteraction(playwin, frog, cars, occupancy, carStopColor, carFrogColor);      // Friendly car interaction (blue one)
+        return;
+    }
+
+    int newX = frog->x;
+    int newY = frog->y;
+    if (frog->remainingMoves > 0 && frog->carried == false) {
+        switch (ch) {
+        case KEY_UP:                    // Moving frog in 4 directions
+            newY--;
+            break;
+        case KEY_DOWN:
+            newY++;
+            break;
+        case KEY_LEFT:
+            newX--;
+            break;
+        case KEY_RIGHT:
+            newX++;
+            break;
+        default:
+            return;
+        }
+        CheckFrogMove(playwin, frog, timer, map, newX, newY);  // Check if frog can move on the new place   
+    }
+
+    ClearInput(input);
+}
+
+
+//------------------------------------------------
+//---------------  STORK FUNCTIONS ---------------
+//------------------------------------------------
+
+STORK InitStork(WIN* w, RNG* rng, int storkColor, char storkSign, int timeToStork) {
+    STORK stork;
+    stork.win = w;
+    stork.x = Random(rng, w->width - 2) + 1;
+    stork.y = w->height - 2;
+    stork.color = storkColor;
+    stork.sign = storkSign;
+    stork.timeToStork = timeToStork;
+    return stork;
+}
+
+FLOWFIELD* InitFlowField(ARENA* arena, WIN* w) {
+    FLOWFIELD* field = ArenaNew<FLOWFIELD>(arena);
+    field->rows = w->height;
+    field->cols = w->width;
+    field->words = (w->width + 63) / 64;
+    int bitsetWords = w->height * field->words;
+    field->open = ArenaArray<unsigned long long>(arena, bitsetWords);
+    field->found = ArenaArray<unsigned long long>(arena, bitsetWords);
+    field->front = ArenaArray<unsigned long long>(arena, bitsetWords);
+    field->next = ArenaArray<unsigned long long>(arena, bitsetWords);
+    field->spread = ArenaArray<unsigned long long>(arena, field->words);
+    field->distance = ArenaArray<int>(arena, w->height * w->width);
+    field->stamp = ArenaArray<unsigned int>(arena, w->height * w->width);
+    memset(field->front, 0, sizeof(unsigned long long) * bitsetWords);
+    memset(field->next, 0, sizeof(unsigned long long) * bitsetWords);
+    memset(field->stamp, 0, sizeof(unsigned int) * w->height * w->width);
+    field->generation = 0;
+    field->frontTop = 0;
+    field->frontBottom = -1;
+    field->done = true;
+    field->dirty = true;
+    field->builds = 0;
+    return field;
+}
+
+STORKS* InitStorks(ARENA* arena, WIN* w, RNG* rng, int storkColor, char storkSign, int timeToStork, int count) {
+    STORKS* storks = ArenaNew<STORKS>(arena);
+    storks->count = count;
+    storks->stork = ArenaArray<STORK>(arena, count);
+    for (int i = 0; i < count; i++) {
+        storks->stork[i] = InitStork(w, rng, storkColor, storkSign, timeToStork);
+    }
+    storks->field = InitFlowField(arena, w);
+    storks->lastMoveTime = 0;
+    return storks;
+}
+
+void MarkFlowFieldDirty(FLOWFIELD* field) {
+    field->dirty = true;            // Obstacles moved, rebuild on the next query
+}
+
+void CopyOpenCells(FLOWFIELD* field, WIN* w, MAP* map) {
+    memset(field->open, 0, sizeof(unsigned long long) * field->rows * field->words);      // The border stays closed
+    for (int row = 1; row < field->rows - 1; row++) {
+        unsigned long long* open = &field->open[row * field->words];
+        for (int x = 1; x < field->cols - 1; x++) {
+            if (MapCell(map, w->scrollY + row, x) != OBSTACLE) {
+                open[x / 64] |= 1ULL << (x % 64);
+            }
+        }
+    }
+    field->scrollY = w->scrollY;
+    field->dirty = false;
+}
+
+void SetFlowDistance(FLOWFIELD* field, int row, int w, unsigned long long bits) {
+    int* distance = &field->distance[row * field->cols + w * 64];
+    unsigned int* stamp = &field->stamp[row * field->cols + w * 64];
+    while (bits != 0) {
+        int bit = __builtin_ctzll(bits);            // Every newly reached cell of the word
+        distance[bit] = field->level;
+        stamp[bit] = field->generation;
+        bits &= bits - 1;
+    }
+}
+
+void ResetFlowField(FLOWFIELD* field, WIN* w, MAP* map, int frogX, int frogY) {
+    if (field->dirty || field->scrollY != w->scrollY) {
+        CopyOpenCells(field, w, map);           // Only when the map changed, not on every frog move
+    }
+    if (++field->generation == 0) {
+        memset(field->stamp, 0, sizeof(unsigned int) * field->rows * field->cols);     // Stamps wrapped around
+        field->generation = 1;
+    }
+    field->frogX = frogX;
+    field->frogY = frogY;
+    field->builds++;
+
+    if (field->frontTop <= field->frontBottom) {
+        memset(&field->front[field->frontTop * field->words], 0, sizeof(unsigned long long) * (field->frontBottom - field->frontTop + 1) * field->words);
+    }
+    memset(field->found, 0, sizeof(unsigned long long) * field->rows * field->words);
+    if (frogX < 1) frogX = 1;                   // A carried frog can be off the board, start from the nearest edge
+    if (frogX > w->width - 2) frogX = w->width - 2;
+    int row = frogY - w->scrollY;
+    field->front[row * field->words + frogX / 64] = 1ULL << (frogX % 64);
+    field->found[row * field->words + frogX / 64] = 1ULL << (frogX % 64);
+    field->level = 0;
+    field->frontTop = row;
+    field->frontBottom = row;
+    field->done = false;
+    SetFlowDistance(field, row, frogX / 64, 1ULL << (frogX % 64));
+}
+
+void ExpandFlowField(FLOWFIELD* field) {
+    int words = field->words;                   // One level of the search, 64 cells at a time
+    int top = (field->frontTop > 1) ? field->frontTop - 1 : 1;
+    int bottom = (field->frontBottom < field->rows - 2) ? field->frontBottom + 1 : field->rows - 2;
+    int nextTop = field->rows;
+    int nextBottom = -1;
+    field->level++;
+
+    for (int row = top; row <= bottom; row++) {
+        unsigned long long* above = &field->front[(row - 1) * words];
+        unsigned long long* same = &field->front[row * words];
+        unsigned long long* below = &field->front[(row + 1) * words];
+        for (int w = 0; w < words; w++) {
+            field->spread[w] = above[w] | same[w] | below[w];       // Storks move diagonally too
+        }
+        unsigned long long* open = &field->open[row * words];
+        unsigned long long* found = &field->found[row * words];
+        unsigned long long* next = &field->next[row * words];
+        bool reached = false;
+        for (int w = 0; w < words; w++) {
+            unsigned long long spread = field->spread[w];
+            unsigned long long left = (spread << 1) | ((w > 0) ? field->spread[w - 1] >> 63 : 0);
+            unsigned long long right = (spread >> 1) | ((w + 1 < words) ? field->spread[w + 1] << 63 : 0);
+            unsigned long long cells = (spread | left | right) & open[w] & ~found[w];
+            next[w] = cells;
+            if (cells != 0) {
+                found[w] |= cells;
+                SetFlowDistance(field, row, w, cells);
+                reached = true;
+            }
+        }
+        if (reached) {
+            if (row < nextTop) nextTop = row;
+            nextBottom = row;
+        }
+    }
+
+    if (field->frontTop <= field->frontBottom) {          // Old front cleared, so rows outside the next band stay empty
+        memset(&field->front[field->frontTop * words], 0, sizeof(unsigned long long) * (field->frontBottom - field->frontTop + 1) * words);
+    }
+    unsigned long long* front = field->front;
+    field->front = field->next;
+    field->next = front;
+    if (nextBottom < 0) {
+        field->done = true;                     // Every reachable cell has its distance
+        memset(&field->front[top * words], 0, sizeof(unsigned long long) * (bottom - top + 1) * words);
+        field->frontTop = 0;
+        field->frontBottom = -1;
+        return;
+    }
+    for (int row = top; row < nextTop; row++) {
+        memset(&field->front[row * words], 0, sizeof(unsigned long long) * words);      // Empty rows of the band
+    }
+    for (int row = nextBottom + 1; row <= bottom; row++) {
+        memset(&field->front[row * words], 0, sizeof(unsigned long long) * words);
+    }
+    field->frontTop = nextTop;
+    field->frontBottom = nextBottom;
+}
+
+int FlowFieldCell(FLOWFIELD* field, int x, int y) {
+    int row = y - field->scrollY;
+    if (row < 1 || row > field->rows - 2 || x < 1 || x > field->cols - 2) {
+        return -1;
+    }
+    int cell = row * field->cols + x;
+    return (field->stamp[cell] == field->generation) ? field->distance[cell] : -1;      // -1 = not found (yet)
+}
+
+int FlowDistance(FLOWFIELD* field, WIN* w, MAP* map, FROG* frog, int x, int y) {
+    if (field->dirty || field->frogX != frog->x || field->frogY != frog->y || field->scrollY != w->scrollY) {
+        ResetFlowField(field, w, map, frog->x, frog->y);    // Only rebuilt after the frog or the map changed
+    }
+    int distance = FlowFieldCell(field, x, y);
+    while (distance < 0 && !field->done) {
+        ExpandFlowField(field);                             // Search only as far as the farthest stork asking
+        distance = FlowFieldCell(field, x, y);
+    }
+    return distance;
+}
+
+void EraseStork(STORK* stork, MAP* map) {
+    if (!stork->win->renderer->draws) return;
+    int mapY = stork->y;
+    int mapX = stork->x;
+
+    int color = 0;
+    char ch = ' ';
+    switch (MapCell(map, mapY, mapX)) {     // Erase the last position of the stork
+    case GRASS:     // Grass                // depends on the type of the position
         color = GRASS_COLOR;
         break;
     case ROAD:      // Road
         color = ROAD_COLOR;
         break;
-    case DESTINATION:       // Destination
+    case DESTINATION:    // Destination
         color = DESTINATION_COLOR;
         break;
-    case OBSTACLE:      // Obstacle
+    case OBSTACLE:         // Obstacle
         color = OBSTACLE_COLOR;
         ch = OBSTACLE_SIGN;
         break;
-    case COIN:          // Coin
-        color = GRASS_COLOR;
+    case COIN:    // Coin
+        color = COIN_COLOR;
+        ch = COIN_SIGN;
         break;
     }
 
-    wattron(frog->win->window, COLOR_PAIR(color));
-    mvwaddch(frog->win->window, mapY, mapX, ch);
-    wattroff(frog->win->window, COLOR_PAIR(color));
-    wrefresh(frog->win->window);
+    stork->win->renderer->put(stork->win, mapY - stork->win->scrollY, mapX, ch, color);
+}
+
+void DrawStork(STORK* stork) {
+    if (!stork->win->renderer->draws) return;
+    stork->win->renderer->put(stork->win, stork->y - stork->win->scrollY, stork->x, stork->sign, stork->color);      // Draw stork in the new position
+}
+
+void DrawStorks(STORKS* storks) {
+    for (int i = 0; i < storks->count; i++) {
+        DrawStork(&storks->stork[i]);
+    }
+}
+
+void StepStork(STORK* stork, FROG* frog, FLOWFIELD* field, MAP* map) {
+    int dx = (stork->x < frog->x) - (stork->x > frog->x);      // Straight at the frog, preferred when it is as short
+    int dy = (stork->y < frog->y) - (stork->y > frog->y);
+    int distance = FlowDistance(field, stork->win, map, frog, stork->x, stork->y);
+    if (distance == 0) {
+        return;
+    }
+    if (distance < 0) {
+        stork->x += dx;                 // Frog out of reach on foot (or the stork on an obstacle), fly straight
+        stork->y += dy;
+        return;
+    }
+    if (FlowFieldCell(field, stork->x + dx, stork->y + dy) == distance - 1) {
+        stork->x += dx;
+        stork->y += dy;
+        return;
+    }
+    for (int stepY = -1; stepY <= 1; stepY++) {
+        for (int stepX = -1; stepX <= 1; stepX++) {             // Around the obstacles, one step closer
+            if (FlowFieldCell(field, stork->x + stepX, stork->y + stepY) == distance - 1) {
+                stork->x += stepX;
+                stork->y += stepY;
+                return;
+            }
+        }
+    }
+}
+
+void MoveStorks(STORKS* storks, FROG* frog, TIMER* timer, MAP* map) {
+    if (storks->count == 0 || timer->time < storks->stork[0].timeToStork) {
+        return;                     // Start moving storks after the delay
+    }
+    else if (timer->time == storks->stork[0].timeToStork) {
+        DrawStorks(storks);       // Start drawing storks after the delay
+        return;
+    }
+
+    int currentTime = timer->elapsed;
+    int timeDiff = currentTime - storks->lastMoveTime;
+
+    DrawStorks(storks);
+
+    if (timeDiff < STORK_MOVE_INTERVAL) {
+        return;         // Strork moves every 2 seconds
+    }
+
+    for (int i = 0; i < storks->count; i++) {
+        EraseStork(&storks->stork[i], map);    // Erase the last position of the storks
+    }
+    for (int i = 0; i < storks->count; i++) {
+        StepStork(&storks->stork[i], frog, storks->field, map);        // Stork moves behind the frog (vertical, horizontal and diagonal movement)
+    }
+
+    DrawStorks(storks);    // Draw the storks in the new position
+
+    storks->lastMoveTime = currentTime;      // Update the last move time
+
+}
+
+
+bool StorkColision(FROG* frog, STORKS* storks, TIMER* timer) {
+    if (storks->count == 0 || timer->time < storks->stork[0].timeToStork || frog->carried) {         // Start checking collision after the delay
+        return false;
+    }
+
+    for (int i = 0; i < storks->count; i++) {
+        if (frog->y == storks->stork[i].y && frog->x == storks->stork[i].x) {         // Check colision with storks
+            return true;
+        }
+    }
+    return false;
+}
+
+//------------------------------------------------
+//---------------  TIMER FUNCTIONS ---------------
+//------------------------------------------------
+
+TIMER* InitTimer(ARENA* arena, WIN* w, int startTime, int frameRate, int maxFrameRate, int checkFrameRate, int carTime) {
+    TIMER* timer = ArenaNew<TIMER>(arena);
+    timer->time = startTime;
+    timer->elapsed = 0;
+    timer->frameRate = frameRate;
+    timer->maxFrameRate = maxFrameRate;
+    timer->checkFrameRate = checkFrameRate;
+    timer->carsTiming = carTime;
+    timer->carsTime = carTime;
+    return timer;
+}
+
+void Timer(TIMER* timer, FROG* frog) {
+    timer->elapsed += timer->frameRate;
+    timer->checkFrameRate += timer->frameRate;
+    if (timer->checkFrameRate >= timer->maxFrameRate) {             // Update time and avaliable moves during the game
+        timer->time++;
+        timer->checkFrameRate = 0;
+        if (frog->remainingMoves < frog->maxMoves) {
+            frog->remainingMoves++;
+        }
+    }
+
+    timer->carsTime--;
+    if (timer->carsTime <= 0) {
+        timer->carsTime = timer->carsTiming;
+    }
+}
+
+long long MonotonicNs() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void InitScheduler(SCHEDULER* scheduler, int frameRate, int maxCatchUp) {
+    scheduler->tickNs = frameRate * 1000000LL;
+    scheduler->nextTick = MonotonicNs() + scheduler->tickNs;
+    scheduler->maxCatchUp = maxCatchUp;
+    scheduler->ticks = 0;
+    scheduler->droppedTicks = 0;
+    scheduler->lastJitter = 0;
+}
+
+int WaitForTicks(SCHEDULER* scheduler) {
+    timespec deadline;
+    deadline.tv_sec = scheduler->nextTick / 1000000000LL;
+    deadline.tv_nsec = scheduler->nextTick % 1000000000LL;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR) {}  // Sleep until the deadline, not for a fixed delay
+
+    long long now = MonotonicNs();
+    scheduler->lastJitter = now - scheduler->nextTick;
+
+    int due = int((now - scheduler->nextTick) / scheduler->tickNs) + 1;       // Ticks whose deadline already passed
+    if (due > scheduler->maxCatchUp) {
+        scheduler->droppedTicks += due - scheduler->maxCatchUp;         // Too far behind, skip ahead instead of
+        scheduler->nextTick = now + scheduler->tickNs;                  // running a burst of ticks
+        due = scheduler->maxCatchUp;
+    }
+    else {
+        scheduler->nextTick += due * scheduler->tickNs;
+    }
+    scheduler->ticks += due;
+    return due;
+}
+
+//------------------------------------------------
+//---------------  STATS FUNCTIONS ---------------
+//------------------------------------------------
+
+void PrintStatsField(WIN* w, int row, const char* text) {
+    Print(w, row, 1, "%-*s", w->width - 2, text);        // Pad to overwrite the old value, not the border
+}
+
+void UpdateStats(WIN* w, STATS* shown, FROG* frog, TIMER* timer, SCHEDULER* scheduler, FRAME* frame, INPUT* input) {
+    if (!w->renderer->draws) return;
+
+    char text[64];
+    if (!shown->drawn) {
+        w->renderer->erase(w);
+        w->renderer->outline(w);                                 // Static part, drawn once per round
+        Print(w, 5, 1, "Name: Maciej");
+        Print(w, 6, 1, "Surname: Drywa");
+        Print(w, 7, 1, "Index: 203556");
+    }
+    if (!shown->drawn || shown->time != timer->time) {          // Show stats that changed
+        shown->time = timer->time;
+        snprintf(text, sizeof(text), "Time: %d", timer->time);
+        PrintStatsField(w, 1, text);
+    }
+    if (!shown->drawn || shown->moves != frog->remainingMoves) {
+        shown->moves = frog->remainingMoves;
+        snprintf(text, sizeof(text), "Moves: %d", frog->remainingMoves);
+        PrintStatsField(w, 2, text);
+    }
+    if (!shown->drawn || shown->points != frog->points) {
+        shown->points = frog->points;
+        snprintf(text, sizeof(text), "Points: %d", frog->points);
+        PrintStatsField(w, 3, text);
+    }
+    int jitter = (scheduler != NULL) ? int(scheduler->lastJitter / 100000) : 0;
+    if (scheduler != NULL && (!shown->drawn || shown->jitter != jitter)) {
+        shown->jitter = jitter;
+        snprintf(text, sizeof(text), "Jitter: %d.%d ms", jitter / 10, jitter % 10);        // How late the last tick started
+        PrintStatsField(w, 4, text);
+    }
+    if (frame != NULL && (!shown->drawn || shown->bytes != frame->lastBytes || shown->writes != frame->lastWrites)) {
+        shown->bytes = frame->lastBytes;
+        shown->writes = frame->lastWrites;
+        if (frame->lastBytes >= 0) {
+            snprintf(text, sizeof(text), "Frame: %lld B", frame->lastBytes);         // Terminal output of the last frame
+            PrintStatsField(w, 8, text);
+            snprintf(text, sizeof(text), "Writes: %lld", frame->lastWrites);
+            PrintStatsField(w, 9, text);
+        }
+        else {
+            PrintStatsField(w, 8, "Frame: - B");                                    // Curses sends it out of sight
+            PrintStatsField(w, 9, "Writes: -");
+        }
+    }
+    if (frame != NULL && (!shown->drawn || shown->skipped != frame->skipped)) {
+        shown->skipped = frame->skipped;
+        snprintf(text, sizeof(text), "Skipped: %lld", frame->skipped);             // Frames merged into the next one
+        PrintStatsField(w, 11, text);
+    }
+    int latency = (input != NULL) ? int(input->lastLatency / 100000) : 0;
+    if (input != NULL && input->keys != NULL && (!shown->drawn || shown->latency != latency)) {
+        shown->latency = latency;
+        snprintf(text, sizeof(text), "Latency: %d.%d ms", latency / 10, latency % 10);     // Last key to screen
+        PrintStatsField(w, 10, text);
+    }
+    shown->drawn = true;
+}
+
+//------------------------------------------------
+//--------------  PROFILER FUNCTIONS -------------
+//------------------------------------------------
+
+const char* PHASE_NAMES[] = { "collision", "win", "frog", "cars", "storks", "stats", "flush" };
+const char* PHASE_LABELS[] = { "Hit", "Win", "Frog", "Cars", "Stor", "Stat", "Draw" };     // Short names for the overlay
+
+int HistogramBucket(long long ns) {
+    unsigned long long value = min((unsigned long long)max(ns, 0LL), (1ULL << 48) - 1);
+    if (value < (1ULL << PROFILE_SUB_BITS)) {
+        return int(value);                          // Small values are exact
+    }
+    int shift = 63 - __builtin_clzll(value) - PROFILE_SUB_BITS;      // Keep the top PROFILE_SUB_BITS + 1 bits
+    return (shift << PROFILE_SUB_BITS) + int(value >> shift);
+}
+
+long long BucketTop(int bucket) {                   // Largest value counted in the bucket
+    if (bucket < (2 << PROFILE_SUB_BITS)) {
+        return bucket;
+    }
+    int shift = (bucket >> PROFILE_SUB_BITS) - 1;
+    long long top = bucket - (shift << PROFILE_SUB_BITS);
+    return ((top + 1) << shift) - 1;
+}
+
+void ClearHistogram(HISTOGRAM* histogram) {
+    histogram->count = 0;
+    histogram->sum = 0;
+    histogram->max = 0;
+    memset(histogram->buckets, 0, sizeof(histogram->buckets));
+}
+
+void AddSample(HISTOGRAM* histogram, long long ns) {
+    histogram->count++;
+    histogram->sum += ns;
+    histogram->max = max(histogram->max, ns);
+    histogram->buckets[HistogramBucket(ns)]++;
+}
+
+long long HistogramPercentile(HISTOGRAM* histogram, HISTOGRAM* other, double fraction) {     // Of both histograms together (other may be NULL)
+    long long count = histogram->count + (other != NULL ? other->count : 0);
+    long long top = max(histogram->max, other != NULL ? other->max : 0);
+    if (count == 0) {
+        return 0;
+    }
+    long long rank = (long long)(fraction * (count - 1)) + 1;
+    long long seen = 0;
+    for (int bucket = 0; bucket < PROFILE_BUCKETS; bucket++) {
+        seen += histogram->buckets[bucket] + (other != NULL ? other->buckets[bucket] : 0);
+        if (seen >= rank) {
+            return min(BucketTop(bucket), top);
+        }
+    }
+    return top;
+}
+
+void ResetProfiler(PROFILER* profiler) {
+    for (int phase = 0; phase < PROFILE_PHASES; phase++) {
+        ClearHistogram(&profiler->round[phase]);
+        ClearHistogram(&profiler->window[0][phase]);
+        ClearHistogram(&profiler->window[1][phase]);
+        profiler->shown[phase][0] = '\0';
+    }
+    profiler->current = 0;
+    profiler->frames = 0;
+    profiler->drawn = false;
+    profiler->heapStart = heapAllocations;
+    profiler->heapAllocations = 0;
+}
+
+PROFILER* InitProfiler(bool overlay, const char* dump) {
+    PROFILER* profiler = new PROFILER;
+    profiler->overlay = overlay;
+    profiler->dump = dump;
+    ResetProfiler(profiler);
+    return profiler;
+}
+
+long long ProfileStart(PROFILER* profiler) {
+    return (profiler != NULL) ? MonotonicNs() : 0;      // Only a branch when profiling is off
+}
+
+void ProfileEnd(PROFILER* profiler, int phase, long long start) {
+    if (profiler == NULL) return;
+
+    long long ns = MonotonicNs() - start;
+    AddSample(&profiler->round[phase], ns);
+    AddSample(&profiler->window[profiler->current][phase], ns);
+}
+
+void ProfileFrame(PROFILER* profiler) {
+    if (profiler == NULL) return;
+
+    profiler->frames++;
+    profiler->heapAllocations = heapAllocations - profiler->heapStart;
+    if (profiler->frames % PROFILE_WINDOW_FRAMES == 0) {
+        profiler->current ^= 1;                         // Drop the older window, keep the newer one in the figures
+        for (int phase = 0; phase < PROFILE_PHASES; phase++) {
+            ClearHistogram(&profiler->window[profiler->current][phase]);
+        }
+    }
+}
+
+void FormatMicros(char* text, int size, long long ns) {
+    long long us = ns / 1000;
+    if (us < 10000) snprintf(text, size, "%lld", us);
+    else snprintf(text, size, "%lldm", us / 1000);
+}
+
+void DrawProfile(WIN* w, PROFILER* profiler, int firstRow) {
+    if (profiler == NULL || !profiler->overlay || !w->renderer->draws) return;
+
+    if (!profiler->drawn) {
+        PrintStatsField(w, firstRow, "us   p50  p99  max");
+        profiler->drawn = true;
+    }
+    char text[STATS_WIDTH];
+    char p50[24], p99[24], top[24];
+    for (int phase = 0; phase < PROFILE_PHASES; phase++) {
+        HISTOGRAM* now = &profiler->window[profiler->current][phase];
+        HISTOGRAM* last = &profiler->window[profiler->current ^ 1][phase];
+        FormatMicros(p50, sizeof(p50), HistogramPercentile(now, last, 0.5));
+        FormatMicros(p99, sizeof(p99), HistogramPercentile(now, last, 0.99));
+        FormatMicros(top, sizeof(top), max(now->max, last->max));
+        snprintf(text, w->width - 1, "%-4s%4s %4s %4s", PHASE_LABELS[phase], p50, p99, top);     // Cut at the border
+        if (strcmp(text, profiler->shown[phase]) != 0) {
+            strcpy(profiler->shown[phase], text);
+            PrintStatsField(w, firstRow + 1 + phase, text);
+        }
+    }
+}
+
+void DumpProfile(PROFILER* profiler, unsigned long long seed, int time, FRAME* frame) {
+    if (profiler == NULL || profiler->dump == NULL) return;
+
+    FILE* file = fopen(profiler->dump, "a");            // One block per round
+    if (file == NULL) {
+        return;
+    }
+    fprintf(file, "round seed %llu time %d frames %d rendered %lld skipped %lld heap_allocations %lld\n", seed, time, profiler->frames,
+        frame->rendered, frame->skipped, profiler->heapAllocations);
+    fprintf(file, "phase count mean_ns p50_ns p90_ns p99_ns p999_ns max_ns\n");
+    for (int phase = 0; phase < PROFILE_PHASES; phase++) {
+        HISTOGRAM* histogram = &profiler->round[phase];
+        fprintf(file, "%s %lld %lld %lld %lld %lld %lld %lld\n", PHASE_NAMES[phase], histogram->count,
+            histogram->count > 0 ? histogram->sum / histogram->count : 0,
+            HistogramPercentile(histogram, NULL, 0.5), HistogramPercentile(histogram, NULL, 0.9),
+            HistogramPercentile(histogram, NULL, 0.99), HistogramPercentile(histogram, NULL, 0.999), histogram->max);
+    }
+    for (int phase = 0; phase < PROFILE_PHASES; phase++) {
+        fprintf(file, "histogram %s\n", PHASE_NAMES[phase]);          // "<bucket top ns> <samples>", empty buckets left out
+        for (int bucket = 0; bucket < PROFILE_BUCKETS; bucket++) {
+            if (profiler->round[phase].buckets[bucket] != 0) {
+                fprintf(file, "%lld %u\n", BucketTop(bucket), profiler->round[phase].buckets[bucket]);
+            }
+        }
+    }
+    fprintf(file, "\n");
+    fclose(file);
+}
+
+//------------------------------------------------
+//---------------  FRAME FUNCTIONS ---------------
+//------------------------------------------------
+
+void InitFrame(FRAME* frame) {
+    frame->lastBytes = -1;
+    frame->lastWrites = -1;
+    frame->lastFlushNs = 0;
+    frame->nextNs = 0;
+    frame->rendered = 0;
+    frame->skipped = 0;
+}
+
+bool FrameDue(WIN* playwin, FRAME* frame, long long now) {
+    if (now < frame->nextNs || playwin->renderer->backedUp(playwin->renderer)) {
+        frame->skipped++;                   // The last frame has not reached the terminal yet, this one goes with the next
+        return false;
+    }
+    return true;
+}
+
+void FlushFrame(WIN* playwin, WIN* statwin, FRAME* frame) {
+    RENDERER* renderer = playwin->renderer;
+    long long bytesBefore, writesBefore, bytesAfter, writesAfter;
+    bool measured = renderer->sent(renderer, &bytesBefore, &writesBefore);
+    long long start = MonotonicNs();
+
+    playwin->renderer->stage(playwin);      // Collect the changes of both windows
+    statwin->renderer->stage(statwin);
+    playwin->renderer->update(playwin->renderer);       // and send them to the terminal at once
+
+    long long end = MonotonicNs();
+    frame->lastFlushNs = end - start;       // Blocked writes show here: the terminal's queue was full
+    frame->nextNs = start + playwin->renderer->frameNs;
+    if (frame->lastFlushNs > RENDER_SLOW_NS) {
+        frame->nextNs = max(frame->nextNs, end + RENDER_BACKOFF * frame->lastFlushNs);
+    }
+    frame->rendered++;
+    if (measured && renderer->sent(renderer, &bytesAfter, &writesAfter)) {
+        frame->lastBytes = bytesAfter - bytesBefore;
+        frame->lastWrites = writesAfter - writesBefore;
+    }
+}
+
+//------------------------------------------------
+//-------------  MAIN DRAW FUNCTIONS  -------------
+//------------------------------------------------
+
+void DrawMap(WIN* win, MAP* map, int rows, int cols) {
+    RENDERER* renderer = win->renderer;
+    if (!renderer->draws) return;
+    renderer->outline(win);                   // Create the border
+
+    for (int y = 1; y < rows - 1; y++) {
+        for (int x = 1; x < cols - 1; x++) {
+            switch (MapCell(map, win->scrollY + y, x)) {
+            case GRASS:                                                 // Draw grass
+                renderer->put(win, y, x, ' ', GRASS_COLOR);
+                break;
+            case ROAD:                                                                                            // Draw road  
+                renderer->put(win, y, x, ' ', ROAD_COLOR);
+                break;
+            case DESTINATION:                                                                              // Draw destination
+                renderer->put(win, y, x, ' ', DESTINATION_COLOR);
+                break;
+            case OBSTACLE:                                                                                // Draw obstacles
+                renderer->put(win, y, x, OBSTACLE_SIGN, OBSTACLE_COLOR);
+                break;
+
+            case COIN:                                                                            // Draw coins
+                renderer->put(win, y, x, COIN_SIGN, COIN_COLOR);
+                break;
+            }
+        }
+    }
+}
+
+
+void DrawGame(WIN* playwin, WIN* statwin, STATS* shown, FRAME* frame, FROG* frog, TIMER* timer, int roadPositions[], MAP* map, int roadCount, int rows, int cols) {
+    // Wyczyść okna
+    playwin->renderer->erase(playwin);            // Not wclear: the next flush only sends what changed, no blank screen in between
+    statwin->renderer->erase(statwin);
+
+
+    // Rysowanie dróg i planszy
+    DrawMap(playwin, map, rows, cols);     // Draw map
+
+    shown->drawn = false;
+    UpdateStats(statwin, shown, frog, timer, NULL, NULL, NULL);                    // Update stats
+
+    // Rysowanie żaby
+    DrawFrog(frog);              // Draw frog       
+
+    InitFrame(frame);
+    FlushFrame(playwin, statwin, frame);
+}
+
+//------------------------------------------------
+//---------------  ENDLESS FUNCTIONS -------------
+//------------------------------------------------
+
+void GenerateChunk(GAME* game) {
+    MAP* map = game->map;
+    OCCUPANCY* occupancy = game->occupancy;
+    CONFIG* config = &game->config;
+    int startRows = config->rows - 1 - ENDLESS_START_ROWS;       // Rows below are the frog's start zone
+    int area = (config->rows - 2) * (config->cols - 2);         // Obstacles and coins as dense as on the fixed board
+
+    int oldTop = map->top;
+    map->top -= ENDLESS_CHUNK_ROWS;                             // Chunk above the current top takes the ring rows
+    map->head = (map->head - ENDLESS_CHUNK_ROWS + map->rows) % map->rows;     // of the rows at the bottom
+    occupancy->top = map->top;
+    occupancy->head = map->head;
+
+    if (game->storks != NULL) {
+        MarkFlowFieldDirty(game->storks->field);                // New obstacles
+    }
+    for (int y = oldTop - 1; y >= map->top; y--) {
+        if (y + map->rows < config->rows) {
+            map->hash ^= RowHash(map, y, y + map->rows);        // The row that leaves the ring (unless it was never made)
+        }
+    }
+
+    for (int y = oldTop - 1; y >= map->top; y--) {
+        int row = OccupancyRow(occupancy, y);
+        for (int k = occupancy->laneCount[row] - 1; k >= 0; k--) {
+            RemoveCar(game->cars, game->frog, occupancy, LaneCar(occupancy, row, k));       // Evict the cars of the old row
+        }
+        ClearOccupancyRow(occupancy, y);
+
+        if (y < startRows && Random(&game->rng, config->rows - 4) < config->carsAndRoads) {
+            memset(&map->cells[RingRow(y, map->top, map->head, map->rows) * map->stride], ROAD, config->cols);
+            int first = AddCar(game->cars, &game->rng, y, config->cols, 0, config->carsPerLane, 0, config->carLength, config->carSpeed, CARM_COLOR, CARS_COLOR);
+            if (first >= 0) {
+                int count = 1;
+                for (int k = 1; k < config->carsPerLane; k++) {
+                    if (AddCar(game->cars, &game->rng, y, config->cols, k, config->carsPerLane, game->cars->direction[first],
+                        config->carLength, config->carSpeed, CARM_COLOR, CARS_COLOR) >= 0) count++;
+                }
+                FillLane(occupancy, game->cars, first, count, config->cols);
+            }
+            continue;
+        }
+        memset(&map->cells[RingRow(y, map->top, map->head, map->rows) * map->stride], GRASS, config->cols);
+        if (y >= startRows) {
+            continue;
+        }
+        for (int x = 1; x < config->cols - 1; x++) {
+            int r = Random(&game->rng, area);
+            if (r < OBSTACLE_COUNT) SetMapCell(map, y, x, OBSTACLE);
+            else if (r < OBSTACLE_COUNT + COINS_COUNT) SetMapCell(map, y, x, COIN);
+        }
+    }
+    for (int y = oldTop - 1; y >= map->top; y--) {
+        map->hash ^= RowHash(map, y, y);                        // and the one that takes its place
+    }
+}
+
+void DrawView(GAME* game) {
+    WIN* playwin = game->playwin;
+    if (!playwin->renderer->draws) return;
+    DrawMap(playwin, game->map, playwin->height, playwin->width);       // Everything moved one or more rows down
+    for (int i = 0; i < game->cars->count; i++) {
+        DrawCars(playwin, game->cars, i);
+    }
+    if (game->storks->count > 0 && game->timer->time >= game->storks->stork[0].timeToStork) {
+        DrawStorks(game->storks);
+    }
+    DrawFrog(game->frog);
+}
+
+void ScrollView(GAME* game) {
+    WIN* playwin = game->playwin;
+    int scrollY = game->frog->y - playwin->height / 2;         // Keep the frog in the lower half of the viewport
+    if (scrollY >= playwin->scrollY) {
+        return;
+    }
+    playwin->scrollY = scrollY;
+    while (game->map->top > scrollY - ENDLESS_CHUNK_ROWS) {
+        GenerateChunk(game);                                    // One chunk ahead of the viewport
+    }
+    int bottom = scrollY + playwin->height - 2;
+    for (int i = 0; i < game->storks->count; i++) {
+        if (game->storks->stork[i].y > bottom) {
+            game->storks->stork[i].y = bottom;                  // Storks never fall out of the ring
+        }
+    }
+    DrawView(game);
+}
+
+//------------------------------------------------
+//------------  STATE HASH FUNCTIONS -------------
+//------------------------------------------------
+
+unsigned long long FrogHash(FROG* frog) {
+    return HashKey(HASH_FROG, 0, (unsigned long long)(unsigned)frog->y << 32 | (unsigned)frog->x)
+        ^ HashKey(HASH_FROG, 1, (unsigned long long)(unsigned)frog->points << 32 | (unsigned)frog->remainingMoves)
+        ^ HashKey(HASH_FROG, 2, (unsigned long long)(unsigned)frog->distance << 32 | (unsigned)frog->lastMoveTime)
+        ^ HashKey(HASH_FROG, 3, (unsigned)(frog->carringCar + 1));      // carried goes with carringCar
+}
+
+unsigned long long StateHash(GAME* game) {
+    unsigned long long hash = game->map->hash ^ game->cars->hash ^ FrogHash(game->frog);      // Boards and cars kept up as they change,
+    for (int i = 0; i < game->storks->count; i++) {                                            // the few other things hashed here
+        STORK* stork = &game->storks->stork[i];
+        hash ^= HashKey(HASH_STORK, i, (unsigned long long)(unsigned)stork->y << 32 | (unsigned)stork->x);
+    }
+    TIMER* timer = game->timer;
+    hash ^= HashKey(HASH_CLOCK, 0, (unsigned long long)(unsigned)timer->elapsed << 32 | (unsigned)timer->time);
+    hash ^= HashKey(HASH_CLOCK, 1, (unsigned long long)(unsigned)timer->checkFrameRate << 32 | (unsigned)timer->carsTime);
+    hash ^= HashKey(HASH_CLOCK, 2, (unsigned long long)(unsigned)game->playwin->scrollY << 32 | (unsigned)game->storks->lastMoveTime);
+    return hash ^ HashKey(HASH_CLOCK, 3, game->rng.state);
+}
+
+unsigned long long RehashState(GAME* game) {
+    unsigned long long kept = game->map->hash ^ game->cars->hash;       // The same hash from a pass over everything (checks only)
+    return StateHash(game) ^ kept ^ MapHash(game->map, game->config.rows) ^ CarsHash(game->cars);
+}
+
+//------------------------------------------------
+//------------  LOGIC OF THE GAME ----------------
+//------------------------------------------------
+
+
+bool CheckCollision(WIN* playwin, WIN* statwin, FROG* frog, STORKS* storks, CARS* cars, TIMER* timer, OCCUPANCY* occupancy, unsigned long long seed) {
+    if (CarColision(frog, cars, occupancy) || StorkColision(frog, storks, timer)) {       // Check colisions with cars and stork
+        playwin->renderer->erase(playwin);                                                              // And print the game results
+        statwin->renderer->erase(statwin);
+        Print(playwin, 1, 1, "You lose!");
+        Print(playwin, 3, 1, "Points: %d", frog->points);           // Print the game result
+        Print(playwin, 4, 1, "Time: %d", timer->time);
+        Print(playwin, 5, 1, "Seed: %llu", seed);                  // To reproduce the round
+        Print(playwin, 6, 1, "Distance: %d", frog->distance);
+        return true;
+    }
+    return false;
+}
+
+
+int RoundState(FROG* frog, STORKS* storks, CARS* cars, TIMER* timer, OCCUPANCY* occupancy, MAP* map) {
+    if (CarColision(frog, cars, occupancy)) {       // Same checks as CheckCollision and CheckWin,
+        return ROUND_CAR_HIT;                                       // without printing anything
+    }
+    if (StorkColision(frog, storks, timer)) {
+        return ROUND_STORK_HIT;
+    }
+    if (FrogOnDestination(frog, map)) {
+        return ROUND_WON;
+    }
+    return ROUND_RUNNING;
+}
+
+void PublishTick(SPECTATOR* spectator, GAME* game, long long tick);
+
+void StepGame(GAME* game, INPUT* input) {
+    Timer(game->timer, game->frog);         // Update time and avaliable moves
+
+    long long start = ProfileStart(game->profiler);
+    FrogMovement(game->playwin, game->frog, game->cars, game->timer, input, game->occupancy, game->map, CARS_COLOR, CARC_COLOR);  // Move frog
+    ProfileEnd(game->profiler, PHASE_FROG, start);
+
+    if (game->config.endless) {
+        ScrollView(game);           // Follow the frog
+    }
+    if (game->playwin->renderer->draws) {
+        TouchCellsAround(game->cars, game->occupancy, game->frog->y, game->frog->x);      // Cars the frog and the storks drew over
+        for (int i = 0; i < game->storks->count; i++) {
+            TouchCellsAround(game->cars, game->occupancy, game->storks->stork[i].y, game->storks->stork[i].x);
+        }
+    }
+
+    start = ProfileStart(game->profiler);
+    MoveCars(game->playwin, game->cars, &game->rng, game->timer, game->frog, game->occupancy, game->config.carLength,
+        game->config.carSpeed, CARM_COLOR, CARS_COLOR);      // Move cars
+    ProfileEnd(game->profiler, PHASE_CARS, start);
+
+    start = ProfileStart(game->profiler);
+    MoveStorks(game->storks, game->frog, game->timer, game->map);    // Move storks
+    ProfileEnd(game->profiler, PHASE_STORKS, start);
+
+    input->tick++;
+    if (input->record != NULL || input->hashCount > 0) {
+        unsigned long long hash = StateHash(game);      // A few XORs, the board and the cars are kept up as they change
+        if (input->record != NULL) {
+            RecordHash(input, hash);                    // Every tick, so a replay finds the tick a build plays differently
+        }
+        CheckHash(input, hash);
+    }
+    if (game->spectator != NULL) {
+        PublishTick(game->spectator, game, input->tick);       // The tick as watchers see it
+    }
+}
+
+
+//------------------------------------------------
+//--------------  SPECTATOR FUNCTIONS ------------
+//------------------------------------------------
+
+size_t SpectatorAlign(size_t bytes) {
+    return (bytes + SPECTATOR_ALIGN - 1) & ~size_t(SPECTATOR_ALIGN - 1);
+}
+
+SPECTATOR_SNAPSHOT* SpectatorSlot(SPECTATOR_HEADER* header, unsigned long long index) {
+    return (SPECTATOR_SNAPSHOT*)((unsigned char*)header + header->slotsOffset + (index % SPECTATOR_SLOTS) * header->slotBytes);
+}
+
+SPECTATOR_CAR* SnapshotCars(SPECTATOR_SNAPSHOT* snapshot) {
+    return (SPECTATOR_CAR*)(snapshot + 1);
+}
+
+SPECTATOR_STORK* SnapshotStorks(SPECTATOR_HEADER* header, SPECTATOR_SNAPSHOT* snapshot) {
+    return (SPECTATOR_STORK*)(SnapshotCars(snapshot) + header->carCapacity);
+}
+
+SPECTATOR_CELL* SnapshotChanges(SPECTATOR_HEADER* header, SPECTATOR_SNAPSHOT* snapshot) {
+    return (SPECTATOR_CELL*)(SnapshotStorks(header, snapshot) + header->storkCapacity);
+}
+
+SPECTATOR* OpenSpectator(const char* name) {
+    SPECTATOR* spectator = new SPECTATOR;
+    snprintf(spectator->name, sizeof(spectator->name), "%s%s", name[0] == '/' ? "" : "/", name);
+    spectator->base = NULL;                 // Sized by the first round
+    spectator->header = NULL;
+    spectator->failed = false;
+    return spectator;
+}
+
+bool CreateSpectatorSegment(SPECTATOR* spectator, GAME* game) {
+    int carCapacity = game->cars->capacity;                 // Same config every round, so the first round sizes them all
+    int storkCapacity = game->storks->count;
+    size_t slotBytes = SpectatorAlign(sizeof(SPECTATOR_SNAPSHOT) + carCapacity * sizeof(SPECTATOR_CAR)
+        + storkCapacity * sizeof(SPECTATOR_STORK) + SPECTATOR_MAX_CHANGES * sizeof(SPECTATOR_CELL));
+    size_t boardOffset = SpectatorAlign(sizeof(SPECTATOR_HEADER));
+    size_t slotsOffset = SpectatorAlign(boardOffset + (size_t)game->map->rows * game->map->stride);
+    size_t bytes = slotsOffset + SPECTATOR_SLOTS * slotBytes;
+
+    shm_unlink(spectator->name);                            // Left by a game that was killed
+    int fd = shm_open(spectator->name, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    void* base = (ftruncate(fd, bytes) == 0) ? mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);                                              // The mapping keeps the segment
+    if (base == MAP_FAILED) {
+        shm_unlink(spectator->name);
+        return false;
+    }
+
+    SPECTATOR_HEADER* header = (SPECTATOR_HEADER*)base;    // Zero filled, so every sequence starts even
+    header->slotBytes = int(slotBytes);
+    header->carCapacity = carCapacity;
+    header->storkCapacity = storkCapacity;
+    header->boardRows = game->map->rows;
+    header->boardCols = game->map->stride;
+    header->viewRows = game->config.rows;
+    header->viewCols = game->config.cols;
+    header->boardOffset = boardOffset;
+    header->slotsOffset = slotsOffset;
+    header->frogSign = game->config.frogSign;
+    header->carSign = game->config.carSign;
+    atomic_thread_fence(memory_order_release);
+    memcpy(header->magic, SPECTATOR_MAGIC, sizeof(header->magic));     // Readers attach once they see it
+
+    spectator->base = (unsigned char*)base;
+    spectator->bytes = bytes;
+    spectator->header = header;
+    spectator->board = spectator->base + boardOffset;
+    return true;
+}
+
+void CopyBoard(SPECTATOR* spectator, MAP* map, int round) {
+    SPECTATOR_HEADER* header = spectator->header;
+    unsigned sequence = header->boardSequence.load(memory_order_relaxed);
+    header->boardSequence.store(sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);              // Odd before any cell changes
+    memcpy(spectator->board, map->cells, min((size_t)map->rows * map->stride, (size_t)header->boardRows * header->boardCols));
+    header->boardTop = map->top;
+    header->boardHead = map->head;
+    header->round = round;
+    header->boardSequence.store(sequence + 2, memory_order_release);
+    spectator->mapChanges = map->changes;
+    spectator->mapTop = map->top;
+}
+
+void SpectateRound(SPECTATOR* spectator, GAME* game) {
+    if (spectator->base == NULL && (spectator->failed || !CreateSpectatorSegment(spectator, game))) {
+        spectator->failed = true;                           // Told when the game ends, not over the screen
+        return;
+    }
+    CopyBoard(spectator, game->map, spectator->header->round + 1);
+    PublishTick(spectator, game, 0);                        // Watchers see the new round before its first tick
+}
+
+void PublishTick(SPECTATOR* spectator, GAME* game, long long tick) {
+    if (spectator->base == NULL) return;
+    SPECTATOR_HEADER* header = spectator->header;
+    MAP* map = game->map;
+
+    long long firstChange = spectator->mapChanges;
+    int changeCount = int(min(map->changes - firstChange, (long long)SPECTATOR_MAX_CHANGES + 1));
+    if (map->top != spectator->mapTop || changeCount > SPECTATOR_MAX_CHANGES || changeCount > MAP_CHANGE_LOG) {
+        CopyBoard(spectator, map, header->round);           // New chunk, or more than a snapshot lists
+        changeCount = -1;
+    }
+    else if (changeCount > 0) {
+        unsigned sequence = header->boardSequence.load(memory_order_relaxed);
+        header->boardSequence.store(sequence + 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+        for (long long k = firstChange; k < map->changes; k++) {
+            int y = map->changeY[k % MAP_CHANGE_LOG];
+            int x = map->changeX[k % MAP_CHANGE_LOG];
+            spectator->board[RingRow(y, map->top, map->head, map->rows) * map->stride + x] = MapCell(map, y, x);
+        }
+        header->boardSequence.store(sequence + 2, memory_order_release);
+        spectator->mapChanges = map->changes;
+    }
+
+    unsigned long long index = header->published.load(memory_order_relaxed);
+    SPECTATOR_SNAPSHOT* snapshot = SpectatorSlot(header, index);
+    unsigned sequence = snapshot->sequence.load(memory_order_relaxed);
+    snapshot->sequence.store(sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);              // Odd before any field changes, readers never wait for it
+
+    snapshot->round = header->round;
+    snapshot->index = index;
+    snapshot->seed = game->seed;
+    snapshot->tick = tick;
+    snapshot->state = RoundState(game->frog, game->storks, game->cars, game->timer, game->occupancy, map);
+    snapshot->time = game->timer->time;
+    snapshot->elapsed = game->timer->elapsed;
+    snapshot->carsTime = game->timer->carsTime;
+    snapshot->carsTiming = game->timer->carsTiming;
+    snapshot->frogX = game->frog->x;
+    snapshot->frogY = game->frog->y;
+    snapshot->frogMoves = game->frog->remainingMoves;
+    snapshot->frogPoints = game->frog->points;
+    snapshot->frogDistance = game->frog->distance;
+    snapshot->frogCarried = game->frog->carried;
+    snapshot->scrollY = game->playwin->scrollY;
+
+    CARS* cars = game->cars;
+    SPECTATOR_CAR* car = SnapshotCars(snapshot);
+    snapshot->carCount = min(cars->count, header->carCapacity);
+    for (int i = 0; i < snapshot->carCount; i++) {
+        car[i].x = cars->x[i];
+        car[i].y = cars->y[i];
+        car[i].length = short(cars->length[i]);
+        car[i].direction = (signed char)cars->direction[i];
+        car[i].color = cars->color[i];
+    }
+
+    STORKS* storks = game->storks;
+    SPECTATOR_STORK* stork = SnapshotStorks(header, snapshot);
+    bool storksOut = storks->count > 0 && game->timer->time >= storks->stork[0].timeToStork;     // As DrawView
+    snapshot->storkCount = storksOut ? min(storks->count, header->storkCapacity) : 0;
+    for (int i = 0; i < snapshot->storkCount; i++) {
+        stork[i].x = storks->stork[i].x;
+        stork[i].y = storks->stork[i].y;
+    }
+
+    SPECTATOR_CELL* change = SnapshotChanges(header, snapshot);
+    snapshot->changeCount = changeCount;
+    for (int i = 0; i < changeCount; i++) {
+        long long k = firstChange + i;
+        change[i].y = map->changeY[k % MAP_CHANGE_LOG];
+        change[i].x = short(map->changeX[k % MAP_CHANGE_LOG]);
+        change[i].type = MapCell(map, change[i].y, change[i].x);
+    }
+
+    snapshot->sequence.store(sequence + 2, memory_order_release);
+    header->published.store(index + 1, memory_order_release);
+}
+
+void CloseSpectator(SPECTATOR* spectator) {
+    if (spectator->base != NULL) {
+        spectator->header->closed.store(1, memory_order_release);
+        munmap(spectator->base, spectator->bytes);
+        shm_unlink(spectator->name);                        // Attached readers keep their mapping
+    }
+    else if (spectator->failed) {
+        cerr << "Cannot publish to shared memory " << spectator->name << endl;
+    }
+    delete spectator;
+}
+
+SPECTATOR_HEADER* AttachSpectator(const char* name, size_t* bytes) {
+    for (int waited = 0; ; waited += 10) {
+        int fd = shm_open(name, O_RDONLY, 0);
+        if (fd >= 0) {
+            struct stat info;
+            bool sized = fstat(fd, &info) == 0 && info.st_size >= (off_t)sizeof(SPECTATOR_HEADER);
+            void* base = sized ? mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+            close(fd);
+            if (base != MAP_FAILED) {
+                SPECTATOR_HEADER* header = (SPECTATOR_HEADER*)base;
+                if (memcmp(header->magic, SPECTATOR_MAGIC, sizeof(header->magic)) == 0) {
+                    atomic_thread_fence(memory_order_acquire);
+                    *bytes = info.st_size;
+                    return header;
+                }
+                munmap(base, info.st_size);                 // Still being set up
+            }
+        }
+        if (waited >= SPECTATOR_ATTACH_MS) {
+            return NULL;
+        }
+        usleep(10000);
+    }
+}
+
+void DrawSnapshot(WIN* view, SPECTATOR_HEADER* header, SPECTATOR_SNAPSHOT* snapshot, MAP* board, int carCount, int storkCount) {
+    RENDERER* renderer = view->renderer;
+    DrawMap(view, board, view->height, view->width);        // Cells read where the game wrote them
+
+    SPECTATOR_CAR* car = SnapshotCars(snapshot);
+    for (int i = 0; i < carCount; i++) {
+        int row = car[i].y - view->scrollY;
+        if (row < 1 || row > view->height - 2) continue;
+        for (int j = 0; j < car[i].length; j++) {
+            int col = car[i].x + j * car[i].direction;
+            if (col > 0 && col < view->width - 1) {
+                renderer->put(view, row, col, header->carSign, car[i].color);
+            }
+        }
+    }
+    SPECTATOR_STORK* stork = SnapshotStorks(header, snapshot);
+    for (int i = 0; i < storkCount; i++) {
+        renderer->put(view, stork[i].y - view->scrollY, stork[i].x, STORK_SIGN, STORK_COLOR);
+    }
+    renderer->put(view, snapshot->frogY - view->scrollY, snapshot->frogX, header->frogSign, FROG_COLOR);
+}
+
+int RunWatch(OPTIONS* options) {
+    RENDERER* renderer = FindRenderer(options->renderer);
+    if (renderer == NULL) {
+        cerr << "Unknown renderer " << options->renderer << endl;
+        return EXIT_FAILURE;
+    }
+    char name[64];
+    snprintf(name, sizeof(name), "%s%s", options->watch[0] == '/' ? "" : "/", options->watch);
+    size_t bytes;
+    SPECTATOR_HEADER* header = AttachSpectator(name, &bytes);
+    if (header == NULL) {
+        cerr << "Nothing published to shared memory " << name << endl;
+        return EXIT_FAILURE;
+    }
+    if (!renderer->start(renderer)) {
+        cerr << "Cannot start the " << renderer->name << " renderer on this terminal" << endl;
+        munmap(header, bytes);
+        return EXIT_FAILURE;
+    }
+
+    ARENA arena;
+    InitArena(&arena);
+    WIN* view = Init(&arena, renderer, header->viewRows, header->viewCols, Y, X, MAIN_COLOR);
+    MAP board;                                              // The shared board as a map, not a copy of it
+    board.rows = header->boardRows;
+    board.cols = header->boardCols;
+    board.stride = header->boardCols;
+    board.cells = (unsigned char*)header + header->boardOffset;
+
+    unsigned long long seen = 0;                            // Snapshots published when the last one was read
+    long long taken = 0, skipped = 0, retried = 0, outOfOrder = 0;
+    int round = 0;
+    long long tick = 0;
+    int state = ROUND_RUNNING;
+    while (true) {
+        unsigned long long published = header->published.load(memory_order_acquire);
+        if (published == seen) {
+            if (header->closed.load(memory_order_acquire)) break;
+            usleep(SPECTATOR_POLL_US);
+            continue;
+        }
+        unsigned long long index = published - 1;          // Only the newest, a slow reader skips ahead
+        SPECTATOR_SNAPSHOT* snapshot = SpectatorSlot(header, index);
+        unsigned boardBefore = header->boardSequence.load(memory_order_acquire);
+        unsigned before = snapshot->sequence.load(memory_order_acquire);
+        board.top = header->boardTop;
+        board.head = header->boardHead;
+        view->scrollY = snapshot->scrollY;
+        int carCount = max(0, min(snapshot->carCount, header->carCapacity));      // Bounded even if the read is torn
+        int storkCount = max(0, min(snapshot->storkCount, header->storkCapacity));
+        int snapshotRound = snapshot->round;
+        long long snapshotTick = snapshot->tick;
+        int snapshotState = snapshot->state;
+        bool fits = board.head >= 0 && board.head < board.rows && view->scrollY >= board.top
+            && view->scrollY + view->height <= board.top + board.rows;         // Board and snapshot show the same rows
+        if (fits && renderer->draws) {
+            DrawSnapshot(view, header, snapshot, &board, carCount, storkCount);
+        }
+        atomic_thread_fence(memory_order_acquire);
+        bool whole = (before & 1) == 0 && (boardBefore & 1) == 0 && snapshot->sequence.load(memory_order_relaxed) == before
+            && header->boardSequence.load(memory_order_relaxed) == boardBefore && snapshot->index == index;
+        if (!whole || !fits) {
+            retried++;                                      // Written while read, try the newest again
+            this_thread::yield();                           // after letting the game finish it on a busy CPU
+            continue;
+        }
+        if (snapshotRound < round || (snapshotRound == round && snapshotTick <= tick && taken > 0)) {
+            outOfOrder++;                                   // Never happens unless the seqlock is broken
+        }
+        skipped += index - seen;
+        seen = published;
+        taken++;
+        round = snapshotRound;
+        tick = snapshotTick;
+        state = snapshotState;
+        renderer->stage(view);
+        renderer->update(renderer);
+    }
+    renderer->close(view);
+    renderer->end(renderer);
+    FreeArena(&arena);
+    munmap(header, bytes);
+
+    printf("snapshots: %lld read, %lld skipped, %lld retried, %lld out of order\n", taken, skipped, retried, outOfOrder);
+    printf("last: round %d tick %lld state %d\n", round, tick, state);
+    return outOfOrder == 0 ? 0 : 1;
+}
+
+
+//------------------------------------------------
+//-------------  SAVE STATE FUNCTIONS ------------
+//------------------------------------------------
+
+void StateField(STATE_CURSOR* cursor, void* field, size_t bytes) {
+    if (cursor->at != NULL) {
+        if (cursor->load) memcpy(field, cursor->at + cursor->bytes, bytes);
+        else memcpy(cursor->at + cursor->bytes, field, bytes);
+    }
+    cursor->bytes += bytes;
+}
+
+size_t TransferState(GAME* game, unsigned char* fields, bool load) {
+    STATE_CURSOR cursor = { fields, 0, load };      // Everything the next ticks read, nothing derived from it
+
+    MAP* map = game->map;
+    StateField(&cursor, map->cells, (size_t)map->rows * map->stride);
+    StateField(&cursor, &map->top, sizeof(int));
+    StateField(&cursor, &map->head, sizeof(int));
+    StateField(&cursor, &map->changes, sizeof(long long));
+    StateField(&cursor, map->changeY, sizeof(map->changeY));
+    StateField(&cursor, map->changeX, sizeof(map->changeX));
+
+    CARS* cars = game->cars;                        // Every slot, so a state always has the same size
+    size_t ints = sizeof(int) * cars->capacity;
+    StateField(&cursor, &cars->count, sizeof(int));
+    StateField(&cursor, cars->x, ints);
+    StateField(&cursor, cars->y, ints);
+    StateField(&cursor, cars->length, ints);
+    StateField(&cursor, cars->direction, ints);
+    StateField(&cursor, cars->speed, ints);
+    StateField(&cursor, cars->xSpeedChange, ints);
+    StateField(&cursor, cars->flags, cars->capacity);
+    StateField(&cursor, cars->color, cars->capacity);
+    StateField(&cursor, cars->wheelSlot, ints);    // The wheel's links are rebuilt from it (RelinkWheel)
+    StateField(&cursor, &cars->wheelTick, sizeof(long long));
+    StateField(&cursor, cars->touch, sizeof(unsigned long long) * cars->words);
+
+    OCCUPANCY* occupancy = game->occupancy;         // Lane order is not derived from the positions, it is kept (the bits are, MarkAllCars)
+    StateField(&cursor, occupancy->lane, sizeof(int) * occupancy->rows * occupancy->perLane);
+    StateField(&cursor, occupancy->laneHead, sizeof(int) * occupancy->rows);
+    StateField(&cursor, occupancy->laneCount, sizeof(int) * occupancy->rows);
+    StateField(&cursor, occupancy->laneWaiting, sizeof(int) * occupancy->rows);
+    StateField(&cursor, occupancy->carSlot, ints);
+    StateField(&cursor, &occupancy->top, sizeof(int));
+    StateField(&cursor, &occupancy->head, sizeof(int));
+
+    FROG* frog = game->frog;
+    StateField(&cursor, &frog->x, sizeof(int));
+    StateField(&cursor, &frog->y, sizeof(int));
+    StateField(&cursor, &frog->remainingMoves, sizeof(int));
+    StateField(&cursor, &frog->points, sizeof(int));
+    StateField(&cursor, &frog->carried, sizeof(bool));
+    StateField(&cursor, &frog->lastMoveTime, sizeof(int));
+    StateField(&cursor, &frog->carringCar, sizeof(int));        // Already an index
+    StateField(&cursor, &frog->startY, sizeof(int));
+    StateField(&cursor, &frog->distance, sizeof(int));
+
+    STORKS* storks = game->storks;
+    StateField(&cursor, &storks->lastMoveTime, sizeof(int));
+    for (int i = 0; i < storks->count; i++) {
+        StateField(&cursor, &storks->stork[i].x, sizeof(int));
+        StateField(&cursor, &storks->stork[i].y, sizeof(int));
+    }
+
+    StateField(&cursor, game->timer, sizeof(TIMER));
+    StateField(&cursor, &game->rng, sizeof(RNG));
+    StateField(&cursor, &game->playwin->scrollY, sizeof(int));
+    return cursor.bytes;
+}
+
+size_t StateBytes(GAME* game) {
+    return (sizeof(STATE_HEADER) + TransferState(game, NULL, false) + 7) & ~(size_t)7;     // Whole words, for the encoding
+}
+
+void StateHeader(GAME* game, long long tick, STATE_HEADER* header) {
+    memset(header, 0, sizeof(STATE_HEADER));        // No stray padding bytes, so equal states are equal bytes
+    memcpy(header->magic, STATE_MAGIC, 4);
+    header->bytes = (unsigned int)StateBytes(game);
+    header->seed = game->seed;
+    header->tick = tick;
+    CONFIG* config = &game->config;
+    header->rows = config->rows;
+    header->cols = config->cols;
+    header->carsAndRoads = config->carsAndRoads;
+    header->carSpeed = config->carSpeed;
+    header->carLength = config->carLength;
+    header->timeToStork = config->timeToStork;
+    header->frogMoves = config->frogMoves;
+    header->storks = config->storks;
+    header->carsPerLane = config->carsPerLane;
+    header->endless = config->endless ? 1 : 0;
+    header->frogSign = config->frogSign;
+    header->carSign = config->carSign;
+}
+
+void ConfigOfState(STATE_HEADER* header, CONFIG* config, unsigned long long* seed) {
+    config->rows = header->rows;
+    config->cols = header->cols;
+    config->carsAndRoads = header->carsAndRoads;
+    config->carSpeed = header->carSpeed;
+    config->carLength = header->carLength;
+    config->timeToStork = header->timeToStork;
+    config->frogMoves = header->frogMoves;
+    config->storks = header->storks;
+    config->carsPerLane = header->carsPerLane;
+    config->endless = header->endless != 0;
+    config->frogSign = header->frogSign;
+    config->carSign = header->carSign;
+    *seed = header->seed;
+}
+
+void SaveState(GAME* game, long long tick, unsigned char* state) {
+    STATE_HEADER header;
+    StateHeader(game, tick, &header);
+    memset(state + header.bytes - 8, 0, 8);         // Padding of the last word
+    memcpy(state, &header, sizeof(STATE_HEADER));
+    TransferState(game, state + sizeof(STATE_HEADER), false);
+}
+
+bool LoadState(GAME* game, const unsigned char* state, long long* tick) {
+    STATE_HEADER header;
+    STATE_HEADER expected;
+    memcpy(&header, state, sizeof(STATE_HEADER));
+    StateHeader(game, header.tick, &expected);
+    if (memcmp(&header, &expected, sizeof(STATE_HEADER)) != 0) {
+        return false;                               // Another round, or another build's layout
+    }
+    TransferState(game, (unsigned char*)state + sizeof(STATE_HEADER), true);
+    RelinkWheel(game->cars);
+    MarkAllCars(game->occupancy, game->cars);
+    game->map->hash = MapHash(game->map, game->config.rows);       // Not in the state, the deltas stay small
+    game->cars->hash = CarsHash(game->cars);
+    MarkFlowFieldDirty(game->storks->field);        // Searched again from the loaded frog and map
+    *tick = header.tick;
+    return true;
+}
+
+int PutVarint(unsigned char* out, unsigned long long value) {
+    int length = 0;
+    while (value >= 0x80) {
+        out[length++] = (unsigned char)((value & 0x7F) | 0x80);      // Same varints as the replays
+        value >>= 7;
+    }
+    out[length++] = (unsigned char)value;
+    return length;
+}
+
+size_t EncodeState(const unsigned long long* state, const unsigned long long* base, size_t words, unsigned char* out) {
+    unsigned char* at = out;                        // Per word: a mask of its non-zero bytes, then those bytes;
+    for (size_t w = 0; w < words; ) {               // a zero mask is followed by the count of zero words after it
+        unsigned long long word = state[w] ^ (base != NULL ? base[w] : 0);     // XOR with the last tick: only what changed
+        if (word == 0) {
+            size_t run = 1;
+            while (w + run < words && state[w + run] == (base != NULL ? base[w + run] : 0)) {
+                run++;
+            }
+            *at++ = 0;
+            at += PutVarint(at, run - 1);
+            w += run;
+            continue;
+        }
+        unsigned char* mask = at++;
+        *mask = 0;
+        for (int b = 0; b < 8; b++) {
+            unsigned char byte = (unsigned char)(word >> (8 * b));
+            if (byte != 0) {
+                *mask |= (unsigned char)(1 << b);
+                *at++ = byte;
+            }
+        }
+        w++;
+    }
+    return at - out;
+}
+
+size_t EncodedBound(size_t words) {
+    return words * 9 + 16;
+}
+
+bool DecodeState(const unsigned char* data, size_t length, unsigned long long* state, size_t words, bool delta) {
+    const unsigned char* end = data + length;
+    size_t w = 0;
+    while (data < end && w < words) {
+        unsigned char mask = *data++;
+        if (mask == 0) {
+            unsigned long long run;
+            if (!ReadVarint(&data, end, &run) || run >= words - w) {
+                return false;
+            }
+            if (!delta) {
+                memset(&state[w], 0, sizeof(unsigned long long) * (run + 1));
+            }
+            w += run + 1;
+            continue;
+        }
+        unsigned long long word = 0;
+        for (int b = 0; b < 8; b++) {
+            if (mask & (1 << b)) {
+                if (data == end) return false;
+                word |= (unsigned long long)*data++ << (8 * b);
+            }
+        }
+        state[w] = delta ? state[w] ^ word : word;
+        w++;
+    }
+    return data == end && w == words;
+}
+
+bool WriteStateFile(const char* filename, GAME* game, long long tick) {
+    FILE* file = fopen(filename, "wb");
+    if (file == NULL) {
+        return false;
+    }
+    size_t bytes = StateBytes(game);
+    size_t words = bytes / 8;
+    unsigned long long* state = new unsigned long long[words];
+    unsigned char* encoded = new unsigned char[EncodedBound(words)];
+    SaveState(game, tick, (unsigned char*)state);
+    size_t headerWords = (sizeof(STATE_HEADER) + 7) / 8;        // The header as is, so the round can be built before decoding
+    size_t length = EncodeState(state + headerWords, NULL, words - headerWords, encoded);
+    bool ok = fwrite(state, 1, headerWords * 8, file) == headerWords * 8 && fwrite(encoded, 1, length, file) == length;
+    ok = fclose(file) == 0 && ok;
+    delete[] encoded;
+    delete[] state;
+    return ok;
+}
+
+unsigned char* ReadStateFile(const char* filename, CONFIG* config, unsigned long long* seed) {
+    FILE* file = fopen(filename, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    size_t headerWords = (sizeof(STATE_HEADER) + 7) / 8;
+    unsigned char* buffer = new unsigned char[size > 0 ? size : 1];
+    bool ok = size >= long(headerWords * 8) && fread(buffer, 1, size, file) == (size_t)size && memcmp(buffer, STATE_MAGIC, 4) == 0;
+    fclose(file);
+
+    unsigned long long* state = NULL;
+    STATE_HEADER header;
+    if (ok) {
+        memcpy(&header, buffer, sizeof(STATE_HEADER));
+        ok = header.bytes % 8 == 0 && header.bytes >= headerWords * 8;
+    }
+    if (ok) {
+        state = new unsigned long long[header.bytes / 8];
+        memcpy(state, buffer, headerWords * 8);
+        ok = DecodeState(buffer + headerWords * 8, size - headerWords * 8, state + headerWords, header.bytes / 8 - headerWords, false);
+    }
+    delete[] buffer;
+    if (!ok) {
+        delete[] state;
+        return NULL;
+    }
+    ConfigOfState(&header, config, seed);
+    return (unsigned char*)state;
+}
+
+void InitRewind(REWIND* rewind) {
+    rewind->stateBytes = 0;
+    rewind->start = NULL;
+    rewind->last = NULL;
+    rewind->next = NULL;
+    rewind->encoded = NULL;
+    rewind->slots = 0;
+    for (int g = 0; g < REWIND_MAX_GROUPS; g++) {
+        rewind->groups[g].data = NULL;
+        rewind->groups[g].bytes = 0;
+        rewind->groups[g].capacity = 0;
+    }
+}
+
+void FreeRewind(REWIND* rewind) {
+    delete[] rewind->start;
+    delete[] rewind->last;
+    delete[] rewind->next;
+    delete[] rewind->encoded;
+    for (int g = 0; g < REWIND_MAX_GROUPS; g++) {
+        delete[] rewind->groups[g].data;
+    }
+    InitRewind(rewind);
+}
+
+size_t RewindMemory(REWIND* rewind) {
+    size_t bytes = 3 * rewind->stateBytes + EncodedBound(rewind->stateBytes / 8);
+    for (int g = 0; g < rewind->slots; g++) {
+        bytes += rewind->groups[g].capacity;
+    }
+    return bytes;
+}
+
+void PushRewind(REWIND* rewind, GAME* game, long long tick) {
+    SaveState(game, tick, (unsigned char*)rewind->next);
+    REWIND_GROUP* group = &rewind->groups[rewind->newest];
+    bool keyframe = rewind->groupCount == 0 || tick - group->tick >= rewind->keyframeTicks;
+    if (keyframe) {
+        rewind->newest = (rewind->newest + 1) % rewind->slots;     // Over the oldest group once the ring is full
+        rewind->groupCount = min(rewind->groupCount + 1, rewind->slots);
+        group = &rewind->groups[rewind->newest];
+        group->tick = tick;
+        group->ticks = 0;
+        group->bytes = 0;
+    }
+    size_t words = rewind->stateBytes / 8;
+    unsigned int length = (unsigned int)EncodeState(rewind->next, keyframe ? rewind->start : rewind->last, words, rewind->encoded);
+    if (group->bytes + 4 + length > group->capacity) {
+        size_t capacity = max(2 * group->capacity, group->bytes + 4 + length);     // Only while the ring fills up
+        unsigned char* data = new unsigned char[capacity];
+        if (group->bytes > 0) memcpy(data, group->data, group->bytes);
+        delete[] group->data;
+        group->data = data;
+        group->capacity = capacity;
+    }
+    memcpy(group->data + group->bytes, &length, 4);
+    memcpy(group->data + group->bytes + 4, rewind->encoded, length);
+    group->bytes += 4 + length;
+    group->ticks++;
+    if (keyframe) {
+        rewind->keyframes++;
+        rewind->keyframeBytes += length;
+    }
+    else {
+        rewind->deltas++;
+        rewind->deltaBytes += length;
+    }
+    swap(rewind->last, rewind->next);
+}
+
+void StartRewind(REWIND* rewind, GAME* game, long long tick) {
+    size_t bytes = StateBytes(game);
+    if (bytes != rewind->stateBytes) {
+        delete[] rewind->start;
+        delete[] rewind->last;
+        delete[] rewind->next;
+        delete[] rewind->encoded;
+        rewind->start = new unsigned long long[bytes / 8];
+        rewind->last = new unsigned long long[bytes / 8];
+        rewind->next = new unsigned long long[bytes / 8];
+        rewind->encoded = new unsigned char[EncodedBound(bytes / 8)];
+        rewind->stateBytes = bytes;
+    }
+    int windowTicks = REWIND_SECONDS * 1000 / game->timer->frameRate;
+    rewind->keyframeTicks = REWIND_KEYFRAME_TICKS;
+    rewind->slots = min(REWIND_MAX_GROUPS, (windowTicks + rewind->keyframeTicks - 1) / rewind->keyframeTicks + 2);
+    rewind->groupCount = 0;
+    rewind->newest = rewind->slots - 1;
+    rewind->keyframes = 0;
+    rewind->keyframeBytes = 0;
+    rewind->deltas = 0;
+    rewind->deltaBytes = 0;
+    SaveState(game, tick, (unsigned char*)rewind->start);
+    PushRewind(rewind, game, tick);                 // The round's first keyframe
+}
+
+long long DecodeRewind(REWIND* rewind, long long tick, unsigned long long* state, bool truncate) {
+    int oldest = (rewind->newest - rewind->groupCount + 1 + rewind->slots) % rewind->slots;
+    REWIND_GROUP* newest = &rewind->groups[rewind->newest];
+    tick = max(tick, rewind->groups[oldest].tick);              // No further back than the ring goes
+    tick = min(tick, newest->tick + newest->ticks - 1);
+    int g = rewind->newest;
+    int dropped = 0;
+    while (rewind->groups[g].tick > tick) {
+        g = (g - 1 + rewind->slots) % rewind->slots;
+        dropped++;
+    }
+    REWIND_GROUP* group = &rewind->groups[g];
+    size_t words = rewind->stateBytes / 8;
+    size_t at = 0;
+    memcpy(state, rewind->start, rewind->stateBytes);
+    for (long long t = group->tick; t <= tick; t++) {           // The keyframe, then one delta per tick
+        unsigned int length;
+        memcpy(&length, group->data + at, 4);
+        DecodeState(group->data + at + 4, length, state, words, true);
+        at += 4 + length;
+    }
+    if (truncate) {
+        group->bytes = at;                                      // The ticks after it are played again
+        group->ticks = int(tick - group->tick + 1);
+        rewind->newest = g;
+        rewind->groupCount -= dropped;
+    }
+    return tick;
+}
+
+void RewindGame(GAME* game, INPUT* input, REWIND* rewind, int ticks) {
+    long long tick = DecodeRewind(rewind, input->tick - ticks, rewind->last, true);
+    LoadState(game, (unsigned char*)rewind->last, &tick);
+    input->tick = int(tick);
+    input->pendingCount = 0;                        // Keys pressed before the rewind are not played after it
+    input->shownNs = 0;
+    if (game->spectator != NULL) {
+        SpectateRound(game->spectator, game);       // Watchers see it as a new round, ticks never go back within one
+    }
+    game->playwin->renderer->erase(game->playwin);
+    game->statwin->renderer->erase(game->statwin);
+    DrawView(game);
+    game->stats.drawn = false;                      // Repainted by the next UpdateStats
+}
+
+bool WaitForRewind(GAME* game, INPUT* input, REWIND* rewind) {
+    Print(game->playwin, 7, 1, "R: rewind  Space: end");
+    FlushFrame(game->playwin, game->statwin, &game->frame);
+    while (true) {
+        int presses = input->keys->rewinds.exchange(0, memory_order_relaxed);
+        if (presses > 0) {
+            RewindGame(game, input, rewind, presses * REWIND_STEP_TICKS);
+            return true;
+        }
+        KEY_EVENT event;
+        while (PopKey(input->keys, LLONG_MAX, &event)) {
+            if (event.key == ' ') {
+                Print(game->playwin, 7, 1, "%21s", "");        // Room for the result screen's lines
+                return false;
+            }
+        }
+        game->playwin->renderer->backedUp(game->playwin->renderer);      // Sends what a backed up terminal still misses of the prompt
+        usleep(REWIND_POLL_MS * 1000);
+    }
+}
+
+
+//------------------------------------------------
+//--------------  LEADERBOARD FUNCTIONS ----------
+//------------------------------------------------
+
+void BoardKey(CONFIG* config, char* key, int size) {
+    int length = snprintf(key, size, "%dx%d/%d/%d/%d/%d/%d/%d", config->rows, config->cols, config->carsAndRoads, config->carSpeed,
+        config->carLength, config->timeToStork, config->frogMoves, config->storks);      // Rounds only compete on the same rules
+    if (config->carsPerLane != 1 && length > 0 && length < size) {
+        snprintf(key + length, size - length, "/%d", config->carsPerLane);     // Keys of one-car lanes stay as they were
+    }
+}
+
+unsigned int Checksum(const char* text, int length) {
+    unsigned int hash = 2166136261u;                    // FNV-1a
+    for (int i = 0; i < length; i++) {
+        hash = (hash ^ (unsigned char)text[i]) * 16777619u;
+    }
+    return hash;
+}
+
+int FormatScore(SCORE* score, char* line, int size) {
+    int length = snprintf(line, size, "%s %llu %d %d", score->board, score->seed, score->points, score->time);
+    return length + snprintf(line + length, size - length, " %08x\n", Checksum(line, length));     // "<board> <seed> <points> <time> <checksum>"
+}
+
+bool ParseScore(const char* line, SCORE* score) {
+    unsigned int checksum;
+    if (strchr(line, '\n') == NULL || sscanf(line, "%47s %llu %d %d %x", score->board, &score->seed, &score->points, &score->time, &checksum) != 5) {
+        return false;                                   // Torn write at the end of the log
+    }
+    char text[128];
+    int length = snprintf(text, sizeof(text), "%s %llu %d %d", score->board, score->seed, score->points, score->time);
+    return Checksum(text, length) == checksum;
+}
+
+bool BetterScore(const SCORE& a, const SCORE& b) {      // More points, then less time, then the older round
+    if (a.points != b.points) return a.points > b.points;
+    if (a.time != b.time) return a.time < b.time;
+    return a.order < b.order;
+}
+
+bool ScoreByBoard(const SCORE& a, const SCORE& b) {
+    int board = strcmp(a.board, b.board);
+    return board != 0 ? board < 0 : BetterScore(a, b);
+}
+
+bool ScoreBySeed(const SCORE& a, const SCORE& b) {
+    int board = strcmp(a.board, b.board);
+    if (board != 0) return board < 0;
+    if (a.seed != b.seed) return a.seed < b.seed;
+    return BetterScore(a, b);
+}
+
+void PruneScores(LEADERBOARD* leaderboard) {
+    SCORE* scores = leaderboard->scores;
+    int count = leaderboard->count;
+    sort(scores, scores + count, ScoreBySeed);
+    for (int i = 0; i < count; i++) {                   // Best round of every seed
+        scores[i].keep = i == 0 || scores[i].seed != scores[i - 1].seed || strcmp(scores[i].board, scores[i - 1].board) != 0;
+    }
+    sort(scores, scores + count, ScoreByBoard);
+    long long* orders = new long long[count > 0 ? count : 1];
+    int tops = 0;
+    int extras = 0;
+    int rank = 0;
+    for (int i = 0; i < count; i++) {
+        rank = (i > 0 && strcmp(scores[i].board, scores[i - 1].board) == 0) ? rank + 1 : 0;
+        if (rank < LEADERBOARD_SIZE) tops++;
+        else if (scores[i].keep) orders[extras++] = scores[i].order;
+    }
+    long long oldest = LLONG_MIN;                       // Seed bests outside the tops older than this go
+    int room = max(0, LEADERBOARD_MAX_SCORES - tops);
+    if (extras > room) {
+        nth_element(orders, orders + (extras - room), orders + extras);
+        oldest = (room > 0) ? orders[extras - room] : LLONG_MAX;
+    }
+    delete[] orders;
+
+    int kept = 0;
+    for (int i = 0; i < count; i++) {                   // and the best rounds of every config
+        rank = (i > 0 && strcmp(scores[i].board, scores[i - 1].board) == 0) ? rank + 1 : 0;
+        if (rank < LEADERBOARD_SIZE || (scores[i].keep && scores[i].order >= oldest)) {
+            scores[kept++] = scores[i];
+        }
+    }
+    leaderboard->count = kept;
+}
+
+void RemoveScore(LEADERBOARD* leaderboard, int i) {
+    memmove(&leaderboard->scores[i], &leaderboard->scores[i + 1], (leaderboard->count - i - 1) * sizeof(SCORE));
+    leaderboard->count--;
+}
+
+void CapScores(LEADERBOARD* leaderboard) {
+    SCORE* scores = leaderboard->scores;
+    int oldest = -1;
+    int rank = 0;
+    for (int i = 0; i < leaderboard->count; i++) {      // One round over the cap: the oldest seed best outside the tops
+        rank = (i > 0 && strcmp(scores[i].board, scores[i - 1].board) == 0) ? rank + 1 : 0;
+        if (rank >= LEADERBOARD_SIZE && (oldest < 0 || scores[i].order < scores[oldest].order)) {
+            oldest = i;
+        }
+    }
+    if (oldest >= 0) {
+        RemoveScore(leaderboard, oldest);
+    }
+}
+
+void AddScore(LEADERBOARD* leaderboard, SCORE* score) {
+    if (leaderboard->count == leaderboard->capacity) {
+        leaderboard->capacity = leaderboard->capacity * 2 + 16;
+        SCORE* scores = new SCORE[leaderboard->capacity];
+        memcpy(scores, leaderboard->scores, leaderboard->count * sizeof(SCORE));
+        delete[] leaderboard->scores;
+        leaderboard->scores = scores;
+    }
+    leaderboard->scores[leaderboard->count++] = *score;
 }
 
-bool CanMove(clock_t lastMoveTime, double interval) {
-    clock_t currentTime = clock();
-    double timeDiff = double(currentTime - lastMoveTime) / CLOCKS_PER_SEC;
-    return (timeDiff >= interval);      // True if timeDiff >= interval
+void InsertScore(LEADERBOARD* leaderboard, int at, SCORE* score) {
+    AddScore(leaderboard, score);                       // Room at the end
+    SCORE* scores = leaderboard->scores;
+    memmove(&scores[at + 1], &scores[at], (leaderboard->count - 1 - at) * sizeof(SCORE));
+    scores[at] = *score;
 }
 
-void CheckFrogMove(WIN* playwin, FROG* frog, int** positionType, int newX, int newY) {
-    if (newX > 0 && newX < playwin->width - 1 && newY > 0 && newY < playwin->height - 1) {
-        if (positionType[newY][newX] != OBSTACLE) {
-            if (positionType[newY][newX] == COIN) {         // Check the type of the new position
-                positionType[newY][newX] = GRASS;           // and allow or block the move
-                frog->points++;
+bool WriteAll(int fd, const char* data, long long size) {
+    while (size > 0) {
+        ssize_t written = write(fd, data, size);
+        if (written <= 0) return false;
+        data += written;
+        size -= written;
+    }
+    return true;
+}
+
+bool CompactLog(const char* path, SCORE* scores, int count) {
+    char temp[512];
+    snprintf(temp, sizeof(temp), "%s.tmp", path);
+    int fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    char* text = new char[(long long)count * 128 + 1];
+    long long size = 0;
+    for (int i = 0; i < count; i++) {
+        size += FormatScore(&scores[i], text + size, 128);
+    }
+    bool written = WriteAll(fd, text, size) && fsync(fd) == 0;
+    delete[] text;
+    close(fd);
+    if (!written || rename(temp, path) != 0) {          // The log is either the old file or the new one, never half of each
+        unlink(temp);
+        return false;
+    }
+
+    char directory[512];
+    snprintf(directory, sizeof(directory), "%s", path);
+    char* slash = strrchr(directory, '/');
+    if (slash != NULL) *slash = '\0';
+    else strcpy(directory, ".");
+    int dir = open(directory, O_RDONLY);
+    if (dir >= 0) {
+        fsync(dir);                                     // Make the rename itself durable
+        close(dir);
+    }
+    return true;
+}
+
+bool AppendScores(int fd, SCORE* scores, int count) {
+    off_t end = lseek(fd, 0, SEEK_END);
+    char* text = new char[(long long)count * 128];
+    long long size = 0;
+    for (int i = 0; i < count; i++) {
+        size += FormatScore(&scores[i], text + size, 128);
+    }
+    bool written = WriteAll(fd, text, size) && fdatasync(fd) == 0;     // Whole lines with O_APPEND, a crash can only tear the last one
+    delete[] text;
+    if (!written && end >= 0 && ftruncate(fd, end) != 0) {             // No half line for the next try to be glued to,
+        WriteAll(fd, "\n", 1);                                         // or at least one that ends and is skipped on load
+    }
+    return written;
+}
+
+void LeaderboardWriter(LEADERBOARD* leaderboard) {
+    int fd = open(leaderboard->path, O_WRONLY | O_APPEND | O_CREAT, 0644);
+    SCORE* pending = NULL;                              // Records not on disk yet, kept until a write succeeds
+    int pendingCount = 0;
+    int pendingCapacity = 0;
+    bool stopping = false;
+    while (!stopping) {
+        unique_lock<mutex> guard(leaderboard->lock);
+        while (!leaderboard->stop && leaderboard->appendCount == 0 && leaderboard->snapshot == NULL) {
+            leaderboard->wake.wait(guard);
+        }
+        stopping = leaderboard->stop;                   // A last try for what is left, then stop
+        if (stopping && pendingCount == 0 && leaderboard->appendCount == 0 && leaderboard->snapshot == NULL) {
+            break;
+        }
+        SCORE* snapshot = leaderboard->snapshot;
+        int snapshotCount = leaderboard->snapshotCount;
+        int covered = pendingCount + leaderboard->snapshotAppends;      // Records of the snapshot still pending
+        leaderboard->snapshot = NULL;
+        if (pendingCount + leaderboard->appendCount > pendingCapacity) {
+            pendingCapacity = (pendingCount + leaderboard->appendCount) * 2 + 16;
+            SCORE* grown = new SCORE[pendingCapacity];
+            memcpy(grown, pending, pendingCount * sizeof(SCORE));
+            delete[] pending;
+            pending = grown;
+        }
+        memcpy(pending + pendingCount, leaderboard->appends, leaderboard->appendCount * sizeof(SCORE));     // Take the queue
+        pendingCount += leaderboard->appendCount;
+        leaderboard->appendCount = 0;
+        guard.unlock();
+
+        if (snapshot != NULL) {
+            if (CompactLog(leaderboard->path, snapshot, snapshotCount)) {
+                if (fd >= 0) close(fd);
+                fd = open(leaderboard->path, O_WRONLY | O_APPEND | O_CREAT, 0644);
+                pendingCount -= covered;                // In the new log, only what came after is appended
+                memmove(pending, pending + covered, pendingCount * sizeof(SCORE));
             }
-            EraseFrog(frog, positionType);
-            frog->x = newX;
-            frog->y = newY;
-            frog->remainingMoves--;             // Change the parameters of the frog and stats if the move is possible
-            frog->lastMoveTime = clock();
-            DrawFrog(frog);
+            delete[] snapshot;                          // Otherwise the old log stays and gets them appended
+        }
+        if (fd < 0) {
+            fd = open(leaderboard->path, O_WRONLY | O_APPEND | O_CREAT, 0644);
+        }
+        if (pendingCount > 0 && fd >= 0 && AppendScores(fd, pending, pendingCount)) {
+            pendingCount = 0;                           // Failed writes are tried again with the next record
         }
     }
+    if (fd >= 0) close(fd);
+    delete[] pending;
 }
 
-void FrogAndCarInteraction(WIN* playwin, FROG* frog, CAR cars[], int carsAndRoadsCount, int carStopColor, int carFrogColor) {
-    if (frog->carried && frog->x > 0 && frog->x <= playwin->width - 2) {
-        frog->carringCar->color = carStopColor;
-        frog->carried = false;
-        frog->carringCar = nullptr;             // Frog exit the car
-        DrawFrog(frog);
-        return;
+void QueueCompaction(LEADERBOARD* leaderboard) {
+    SCORE* snapshot = new SCORE[leaderboard->count > 0 ? leaderboard->count : 1];
+    memcpy(snapshot, leaderboard->scores, leaderboard->count * sizeof(SCORE));
+    lock_guard<mutex> guard(leaderboard->lock);
+    delete[] leaderboard->snapshot;
+    leaderboard->snapshot = snapshot;
+    leaderboard->snapshotCount = leaderboard->count;
+    leaderboard->snapshotAppends = leaderboard->appendCount;        // Already in the snapshot
+    leaderboard->logRecords = leaderboard->count;
+    leaderboard->wake.notify_one();
+}
+
+LEADERBOARD* OpenLeaderboard(const char* path) {
+    LEADERBOARD* leaderboard = new LEADERBOARD;
+    leaderboard->path = path;
+    leaderboard->scores = NULL;
+    leaderboard->count = 0;
+    leaderboard->capacity = 0;
+    leaderboard->logRecords = 0;
+    leaderboard->nextOrder = 0;
+    leaderboard->appends = NULL;
+    leaderboard->appendCount = 0;
+    leaderboard->appendCapacity = 0;
+    leaderboard->snapshot = NULL;
+    leaderboard->snapshotCount = 0;
+    leaderboard->snapshotAppends = 0;
+    leaderboard->stop = false;
+
+    bool damaged = false;
+    FILE* file = fopen(path, "r");                      // Read once, at startup
+    if (file != NULL) {
+        char line[256];
+        SCORE score;
+        while (fgets(line, sizeof(line), file) != NULL) {
+            leaderboard->logRecords++;
+            if (!ParseScore(line, &score)) {
+                damaged = true;                         // Skipped, and gone after the compaction below
+                continue;
+            }
+            score.order = leaderboard->nextOrder++;
+            AddScore(leaderboard, &score);
+        }
+        fclose(file);
     }
-    else if (!frog->carried) {
-        for (int i = 0; i < carsAndRoadsCount; i++) {
-            if (CheckIfFrogIsOnCar(frog, cars[i])) {            // Frog enetr the car
-                frog->carried = true;
-                frog->carringCar = &cars[i];
-                frog->carringCar->color = carFrogColor;
+    PruneScores(leaderboard);
+
+    leaderboard->writer = std::thread(LeaderboardWriter, leaderboard);
+    if (damaged || leaderboard->logRecords > 2 * leaderboard->count + LEADERBOARD_SLACK) {
+        QueueCompaction(leaderboard);
+    }
+    return leaderboard;
+}
+
+int RecordScore(LEADERBOARD* leaderboard, CONFIG* config, unsigned long long seed, int points, int time, bool* seedBest) {
+    SCORE score;
+    BoardKey(config, score.board, sizeof(score.board));
+    score.seed = seed;
+    score.points = points;
+    score.time = time;
+    score.order = leaderboard->nextOrder++;
+
+    SCORE* scores = leaderboard->scores;                // Still sorted by ScoreByBoard, the round goes in its place
+    int at = int(upper_bound(scores, scores + leaderboard->count, score, ScoreByBoard) - scores);
+    int first = at;
+    while (first > 0 && strcmp(scores[first - 1].board, score.board) == 0) {
+        first--;
+    }
+    *seedBest = true;                                   // Unless a better round had the same seed
+    for (int j = first; j < at; j++) {
+        if (scores[j].seed == seed) *seedBest = false;
+    }
+    score.keep = *seedBest;
+    int rank = (at - first < LEADERBOARD_SIZE) ? at - first + 1 : 0;      // Place on the config's board (0 if not in the top)
+
+    if (rank > 0 || score.keep) {
+        InsertScore(leaderboard, at, &score);
+        scores = leaderboard->scores;
+        int end = at + 1;
+        while (end < leaderboard->count && strcmp(scores[end].board, score.board) == 0) {
+            end++;
+        }
+        for (int j = at + 1; score.keep && j < end; j++) {
+            if (scores[j].seed == seed) {
+                scores[j].keep = false;                 // No longer the best round of its seed
+                if (j - first >= LEADERBOARD_SIZE) {
+                    RemoveScore(leaderboard, j);
+                    end--;
+                }
+                break;
             }
         }
-        return;
+        int pushed = first + LEADERBOARD_SIZE;          // Out of the top by the new round
+        if (rank > 0 && pushed < end && !scores[pushed].keep) {
+            RemoveScore(leaderboard, pushed);
+        }
+        if (leaderboard->count > LEADERBOARD_MAX_SCORES) {
+            CapScores(leaderboard);
+        }
     }
+
+    bool compact;
+    {
+        lock_guard<mutex> guard(leaderboard->lock);
+        if (leaderboard->appendCount == leaderboard->appendCapacity) {
+            leaderboard->appendCapacity = leaderboard->appendCapacity * 2 + 16;
+            SCORE* appends = new SCORE[leaderboard->appendCapacity];
+            memcpy(appends, leaderboard->appends, leaderboard->appendCount * sizeof(SCORE));
+            delete[] leaderboard->appends;
+            leaderboard->appends = appends;
+        }
+        leaderboard->appends[leaderboard->appendCount++] = score;       // Written by the writer thread
+        leaderboard->logRecords++;
+        leaderboard->wake.notify_one();
+        compact = leaderboard->logRecords > 2 * leaderboard->count + LEADERBOARD_SLACK;
+    }
+    if (compact) {
+        QueueCompaction(leaderboard);                   // Most of the log is stale
+    }
+    return rank;
 }
 
-void FrogMovement(WIN* playwin, FROG* frog, CAR cars[], int carsAndRoadsCount, int** positionType, int carStopColor, int carFrogColor) {
-    int ch = wgetch(playwin->window);
+void CloseLeaderboard(LEADERBOARD* leaderboard) {
+    {
+        lock_guard<mutex> guard(leaderboard->lock);
+        leaderboard->stop = true;
+        leaderboard->wake.notify_one();
+    }
+    leaderboard->writer.join();                         // Everything queued is on disk
+    delete[] leaderboard->scores;
+    delete[] leaderboard->appends;
+    delete[] leaderboard->snapshot;
+    delete leaderboard;
+}
 
-    if (!CanMove(frog->lastMoveTime, 0.2)) {        // Break between moves
-        return;
+bool CheckWin(WIN* playwin, WIN* statwin, FROG* frog, TIMER* timer, MAP* map, unsigned long long seed, LEADERBOARD* leaderboard, CONFIG* config) {
+    if (FrogOnDestination(frog, map)) {                 // Check if frog reached the destination
+        statwin->renderer->erase(statwin);
+        playwin->renderer->erase(playwin);
+        bool seedBest = false;
+        int rank = (leaderboard != NULL) ? RecordScore(leaderboard, config, seed, frog->points, timer->time, &seedBest) : 0;    // No file access here
+        if (rank == 1) {
+            Print(playwin, 2, 1, "New High Score!");
+        }
+        Print(playwin, 1, 1, "You win!");
+        Print(playwin, 3, 1, "Points: %d", frog->points);          // Print the game results
+        Print(playwin, 4, 1, "Time: %d", timer->time);
+        Print(playwin, 5, 1, "Seed: %llu", seed);
+        if (rank > 0) {
+            Print(playwin, 6, 1, "Rank: %d%s", rank, seedBest ? ", best on this seed" : "");
+        }
+        else if (seedBest) {
+            Print(playwin, 6, 1, "Best on this seed");
+        }
+        return true;
     }
+    return false;
+}
 
-    if (ch == ' ') {
-        FrogAndCarInteraction(playwin, frog, cars, carsAndRoadsCount, carStopColor, carFrogColor);      // Friendly car interaction (blue one)
+
+//------------------------------------------------
+//---------  GAME PARAMETERS FUNCTIONS -----------
+//------------------------------------------------
+
+void LoadConfig(const char* filename, CONFIG* config) {
+    config->timeToStork = TIME_TO_STORK;                    // Optional in the file
+    config->frogMoves = FROG_REMAINING_MOVES;
+    config->storks = STORKS_COUNT;
+    config->carsPerLane = CARS_PER_LANE;
+    FILE* file = fopen(filename, "r");
+    if (file != NULL) {
+        if (fscanf(file, "ROWS: %d\n COLS: %d\n CAR_AND_ROADS: %d\n FROG_SIGN: %c\n CAR_SIGN: %c\n CAR_SPEED: %d\n CAR_LENGTH: %d",     // Load game parameters from file
+            &config->rows, &config->cols, &config->carsAndRoads, &config->frogSign, &config->carSign, &config->carSpeed, &config->carLength) != 7) {
+            config->rows = 20;
+            config->cols = 30;
+            config->carsAndRoads = 9;
+            config->frogSign = '@';
+            config->carSign = '#';
+            config->carSpeed = 3;                                  // If file is empty or parameters are incorrect,
+            config->carLength = 3;                                 // set default values
+        }
+        else if (fscanf(file, " TIME_TO_STORK: %d", &config->timeToStork) == 1 && fscanf(file, " FROG_MOVES: %d", &config->frogMoves) == 1) {
+            if (fscanf(file, " STORKS: %d", &config->storks) == 1) {
+                fscanf(file, " CARS_PER_LANE: %d", &config->carsPerLane);
+            }
+        }
+        fclose(file);
+    }
+    else {
+        config->rows = 20;
+        config->cols = 30;
+        config->carsAndRoads = 9;
+        config->frogSign = '@';
+        config->carSign = '#';
+        config->carSpeed = 3;
+        config->carLength = 3;
+    }
+}
+
+const char* CheckConfig(CONFIG* config) {
+    if (config->rows < 5 || config->carLength < 1 || config->carSpeed < 1 || config->carsAndRoads < 0) {
+        return "ROWS must be at least 5, CAR_LENGTH and CAR_SPEED at least 1";
+    }
+    if (config->timeToStork < 0 || config->frogMoves < 1 || config->storks < 0) {
+        return "TIME_TO_STORK and STORKS can't be negative and FROG_MOVES must be at least 1";
+    }
+    if (config->carsPerLane < 1) {
+        return "CARS_PER_LANE must be at least 1";
+    }
+    if (config->cols < config->carLength + 3) {
+        return "COLS must be at least CAR_LENGTH + 3";         // Room to place a car on the board
+    }
+    if (config->carsAndRoads > config->rows - 4) {
+        return "CAR_AND_ROADS can't be more than ROWS - 4";    // Roads only go on rows 2 .. ROWS - 3
+    }
+    if (!config->endless && (long long)(config->rows - 3 - config->carsAndRoads) * (config->cols - 2) < OBSTACLE_COUNT + COINS_COUNT) {
+        return "not enough grass for the obstacles and coins";    // Endless boards scale them to the board instead
+    }
+    return NULL;
+}
+
+void InitParameters(ARENA* arena, RNG* rng, int roadPositions[], MAP* map, int rows, int cols, int roads) {
+
+    memset(map->cells, GRASS, rows * map->stride);            // Set grass positions
+
+    memset(&map->cells[1 * map->stride], DESTINATION, cols);       // Set destination position    
+
+
+    int roadRows = rows - 4;                        // Roads go on rows 2 .. rows - 3
+    int roadsCreated = 0;
+    for (int j = roadRows - roads; j < roadRows; j++) {     // Set road positions (Floyd's sampling: one draw per road,
+        int roadY = Random(rng, j + 1) + 2;                 // no redraws however many rows are taken)
+        if (MapCell(map, roadY, 0) == ROAD) {
+            roadY = j + 2;                          // Already a road, row j + 2 is free for sure
+        }
+        roadPositions[roadsCreated++] = roadY;
+        memset(&map->cells[roadY * map->stride], ROAD, cols);
+    }
+
+
+    size_t mark = ArenaMark(arena);                 // Scratch arrays, given back at the end
+    int* grassRows = ArenaArray<int>(arena, rows);  // Rows obstacles and coins can go on
+    int grassCount = 0;
+    for (int y = 2; y < rows - 1; y++) {
+        if (MapCell(map, y, 0) == GRASS) {
+            grassRows[grassCount++] = y;
+        }
+    }
+
+    int width = cols - 2;
+    int cells = grassCount * width;                 // Grass cells, numbered row after row
+    int placed = OBSTACLE_COUNT + COINS_COUNT;      // At most cells (checked by CheckConfig)
+    int* chosen = ArenaArray<int>(arena, placed);
+    int chosenCount = 0;
+    for (int j = cells - placed; j < cells; j++) {          // Set obstacles positions (same sampling over the grass cells)
+        int cell = Random(rng, j + 1);
+        if (MapCell(map, grassRows[cell / width], cell % width + 1) != GRASS) {
+            cell = j;
+        }
+        SetMapCell(map, grassRows[cell / width], cell % width + 1, OBSTACLE);      // Obstacles must be on grass
+        chosen[chosenCount++] = cell;
+    }
+
+    for (int i = 0; i < COINS_COUNT; i++) {         // Set coins positions: a random part of the chosen cells
+        int k = i + Random(rng, placed - i);
+        int cell = chosen[k];
+        chosen[k] = chosen[i];
+        chosen[i] = cell;
+        SetMapCell(map, grassRows[cell / width], cell % width + 1, COIN);          // Coins can't be on obstacles
+    }
+    ArenaRewind(arena, mark);
+    map->hash = MapHash(map, rows);                 // Once, then kept up cell by cell
+
+}
+
+void InitEndlessRound(GAME* game) {
+    CONFIG* config = &game->config;
+    int ringRows = config->rows + 2 * ENDLESS_CHUNK_ROWS;          // Viewport plus the chunks generated ahead, whatever the distance
+
+    game->map = InitMap(game->arena, ringRows, config->cols);
+    game->cars = InitCars(game->arena, game->playwin, &game->rng, game->roadPositions, 0, config->carsPerLane, ringRows * config->carsPerLane, config->carLength, config->carSpeed, CARM_COLOR, CARS_COLOR, config->carSign);   // At most a lane per ring row
+    game->occupancy = InitOccupancy(game->arena, game->cars, ringRows, config->cols, config->carLength, config->carsPerLane);
+    game->frog = NULL;
+    game->storks = NULL;
+
+    game->map->top = config->rows;              // Empty ring below the board, filled a chunk at a time upwards
+    while (game->map->top > -ENDLESS_CHUNK_ROWS) {
+        GenerateChunk(game);
+    }
+
+    game->storks = InitStorks(game->arena, game->playwin, &game->rng, STORK_COLOR, STORK_SIGN, config->timeToStork, config->storks);
+    game->frog = InitFrog(game->arena, game->playwin, &game->rng, FROG_COLOR, config->frogSign, config->frogMoves, game->map);
+    game->timer = InitTimer(game->arena, game->statwin, START_TIME, FRAME_RATE, MAX_FRAME_RATE, CHECK_FRAME_RATE, config->carSpeed * config->carSpeed);
+}
+
+int StatsHeight(GAME* game) {
+    return (game->profiler != NULL && game->profiler->overlay) ? STATS_HEIGHT + PROFILE_PHASES + 1 : STATS_HEIGHT;     // Room for the profiler
+}
+
+void InitRound(GAME* game, RENDERER* renderer) {
+    CONFIG* config = &game->config;
+
+    SeedRandom(&game->rng, game->seed);         // Everything random in the round comes from its seed
+
+    game->roadPositions = ArenaArray<int>(game->arena, config->carsAndRoads);     // Init road positions
+
+    game->playwin = Init(game->arena, renderer, config->rows, config->cols, Y, X, MAIN_COLOR);                                      // Init subwindow for the game (headless if renderer is NULL)
+    game->statwin = Init(game->arena, renderer, StatsHeight(game), STATS_WIDTH, Y, config->cols + 1 + X, MAIN_COLOR);    // Init subwindow for the stats
+
+    if (config->endless) {
+        InitEndlessRound(game);
         return;
     }
 
-    int newX = frog->x;
-    int newY = frog->y;
-    if (frog->remainingMoves > 0 && frog->carried == false) {
-        switch (ch) {
-        case KEY_UP:                    // Moving frog in 4 directions
-            newY--;
-            break;
-        case KEY_DOWN:
-            newY++;
-            break;
-        case KEY_LEFT:
-            newX--;
-            break;
-        case KEY_RIGHT:
-            newX++;
+    game->map = InitMap(game->arena, config->rows, config->cols);             // Init game map positions
+
+    InitParameters(game->arena, &game->rng, game->roadPositions, game->map, config->rows, config->cols, config->carsAndRoads);        // Init game map (randomize positions on the map)
+
+    game->storks = InitStorks(game->arena, game->playwin, &game->rng, STORK_COLOR, STORK_SIGN, config->timeToStork, config->storks);                     // Init stork parameters
+    game->frog = InitFrog(game->arena, game->playwin, &game->rng, FROG_COLOR, config->frogSign, config->frogMoves, game->map);    // Init frog parameters
+
+    game->timer = InitTimer(game->arena, game->statwin, START_TIME, FRAME_RATE, MAX_FRAME_RATE, CHECK_FRAME_RATE, config->carSpeed * config->carSpeed);    // Init timer parameters
+
+    game->cars = InitCars(game->arena, game->playwin, &game->rng, game->roadPositions, config->carsAndRoads, config->carsPerLane, config->carsAndRoads * config->carsPerLane, config->carLength, config->carSpeed, CARM_COLOR, CARS_COLOR, config->carSign);    // Init cars parameters
+    game->occupancy = InitOccupancy(game->arena, game->cars, config->rows, config->cols, config->carLength, config->carsPerLane);      // Index of the cells taken by cars
+}
+
+void CleanupRound(GAME* game) {
+    game->playwin->renderer->close(game->playwin);
+    game->statwin->renderer->close(game->statwin);
+    ResetArena(game->arena);                  // Cleanup all game parameters at once
+}
+
+//------------------------------------------------
+//----------------  MainLoop FUNCTION ------------
+//------------------------------------------------
+
+void MainLoop(GAME* game, INPUT* input, REWIND* rewind) {
+    KEY_QUEUE keys;
+    if (input->scriptTicks == NULL) {
+        StartKeyReader(&keys, STDIN_FILENO);        // Keyboard, unless a replay is playing (even one without keys)
+        input->keys = &keys;
+    }
+    RewindInput(input);
+    if (input->keys == NULL) {
+        rewind = NULL;                              // Nothing to press R on
+    }
+    if (rewind != NULL) {
+        StartRewind(rewind, game, input->tick);     // Practice mode
+    }
+
+    SCHEDULER scheduler;
+    InitScheduler(&scheduler, game->timer->frameRate, MAX_CATCH_UP_TICKS);       // Fixed timestep on the monotonic clock
+
+    if (game->profiler != NULL) {
+        ResetProfiler(game->profiler);
+    }
+
+    while (true) {
+        long long start = ProfileStart(game->profiler);
+        if (CheckCollision(game->playwin, game->statwin, game->frog, game->storks, game->cars, game->timer, game->occupancy, game->seed)) {    // Check coliisions and win conditions
+            if (rewind != NULL && WaitForRewind(game, input, rewind)) {
+                InitScheduler(&scheduler, game->timer->frameRate, MAX_CATCH_UP_TICKS);     // No catching up on the time spent waiting
+                continue;
+            }
+            break;                                  // The result screen is not timed
+        }
+        ProfileEnd(game->profiler, PHASE_COLLISION, start);
+        start = ProfileStart(game->profiler);
+        if (CheckWin(game->playwin, game->statwin, game->frog, game->timer, game->map, game->seed, game->leaderboard, &game->config)) {
             break;
-        default:
-            return;
         }
-        CheckFrogMove(playwin, frog, positionType, newX, newY);  // Check if frog can move on the new place   
+        ProfileEnd(game->profiler, PHASE_WIN, start);
+
+        int due = WaitForTicks(&scheduler);         // Sleep until the next deadline
+        if (rewind != NULL) {
+            int presses = keys.rewinds.exchange(0, memory_order_relaxed);
+            if (presses > 0) {
+                RewindGame(game, input, rewind, presses * REWIND_STEP_TICKS);
+            }
+        }
+
+        for (int i = 0; i < due && RoundState(game->frog, game->storks, game->cars, game->timer, game->occupancy, game->map) == ROUND_RUNNING; i++) {
+            input->tickEndNs = scheduler.nextTick - (due - i) * scheduler.tickNs;      // Keys are played in the tick they were pressed
+            StepGame(game, input);         // Update time, move frog, cars and stork (more than once when catching up)
+            if (rewind != NULL) {
+                PushRewind(rewind, game, input->tick);
+            }
+        }
+
+        start = ProfileStart(game->profiler);
+        UpdateStats(game->statwin, &game->stats, game->frog, game->timer, &scheduler, &game->frame, input);         // Update stats
+        DrawProfile(game->statwin, game->profiler, STATS_HEIGHT - 1);
+        ProfileEnd(game->profiler, PHASE_STATS, start);
+
+        if (FrameDue(game->playwin, &game->frame, MonotonicNs())) {        // Ticks never wait for the terminal, frames do
+            start = ProfileStart(game->profiler);
+            FlushFrame(game->playwin, game->statwin, &game->frame);    // One terminal update per frame
+            ProfileEnd(game->profiler, PHASE_FLUSH, start);
+            NoteLatency(input, MonotonicNs());
+        }
+        ProfileFrame(game->profiler);
     }
+    DumpProfile(game->profiler, game->seed, game->timer->time, &game->frame);
 
-    while (wgetch(playwin->window) != ERR) {          // Clear buffer
-        NULL;
+    if (input->keys != NULL) {
+        StopKeyReader(&keys);
+        input->keys = NULL;
     }
-}
 
+    return;
+}
 
 //------------------------------------------------
-//---------------  STORK FUNCTIONS ---------------
+//---------------  HEADLESS FUNCTIONS ------------
 //------------------------------------------------
 
-STORK* InitStork(WIN* w, int storkColor, char storkSign, int timeToStork) {
-    STORK* stork = new STORK;
-    stork->win = w;
-    stork->x = rand() % (w->width - 2) + 1;
-    stork->y = w->height - 2;
-    stork->color = storkColor;
-    stork->sign = storkSign;
-    stork->timeToStork = timeToStork;
-    stork->lastMoveTime = clock();
-    return stork;
+double NowSeconds() {
+    return MonotonicNs() / 1e9;
 }
 
-void EraseStork(STORK* stork, int** positionType) {
-    int mapY = stork->y;
-    int mapX = stork->x;
+int RunHeadless(OPTIONS* options, INPUT* input, CONFIG* config) {
+    long long heldBefore = HeapBlocksHeld();
+    ARENA arena;
+    InitArena(&arena);
+    GAME game;
+    game.config = *config;
+    game.arena = &arena;
+    game.profiler = NULL;
+    game.spectator = (options->spectate != NULL) ? OpenSpectator(options->spectate) : NULL;
+
+    long long ticks = 0;
+    long long rounds = 0;
+    long long results[4] = { 0, 0, 0, 0 };      // Indexed by ROUND_* state
+    double start = NowSeconds();
+    double stepSeconds = 0;                     // Time spent in ticks, without round setup
+    int bestDistance = 0;
+    long long tickAllocations = 0;              // Heap allocations while the rounds run
+    long long setupAllocations = 0;             // and while rounds after the first are set up
+
+    while (ticks < options->ticks && (options->rounds == 0 || rounds < options->rounds)) {
+        game.seed = options->seed + rounds;     // Round n of a run always gets the same seed
+        long long setupStart = heapAllocations;
+        InitRound(&game, NULL);                 // Same rules, no curses and no frame delay
+        if (rounds > 0) {
+            setupAllocations += heapAllocations - setupStart;
+        }
+        long long loadedTick = 0;
+        if (rounds == 0 && options->state != NULL && !LoadState(&game, options->state, &loadedTick)) {
+            cerr << "State " << options->loadState << " does not fit its round" << endl;
+        }
+        if (game.spectator != NULL) {
+            SpectateRound(game.spectator, &game);
+        }
+        RewindInput(input);
+        input->tick = int(loadedTick);          // A loaded round goes on from its tick (and its script from there)
+        if (options->record != NULL) {
+            StartRecording(input, options->record, game.seed, &game.config);       // Keeps the last round
+        }
+        int state = ROUND_RUNNING;
+        double stepStart = NowSeconds();
+        long long tickStart = heapAllocations;
+        while (ticks < options->ticks && (state = RoundState(game.frog, game.storks, game.cars, game.timer, game.occupancy, game.map)) == ROUND_RUNNING) {
+            StepGame(&game, input);
+            ticks++;
+        }
+        tickAllocations += heapAllocations - tickStart;
+        stepSeconds += NowSeconds() - stepStart;
+        if (game.frog->distance > bestDistance) {
+            bestDistance = game.frog->distance;
+        }
+        StopRecording(input);
+        if (options->saveState != NULL && !WriteStateFile(options->saveState, &game, input->tick)) {
+            cerr << "Cannot write state " << options->saveState << endl;       // Keeps the last round
+        }
+        results[state]++;
+        rounds++;
+        CleanupRound(&game);
+    }
+    size_t arenaBytes = arena.capacity;
+    long long arenaBlocks = arena.heapBlocks;
+    FreeArena(&arena);
+    if (game.spectator != NULL) {
+        CloseSpectator(game.spectator);
+    }
 
-    int color = 0;
-    char ch = ' ';
-    switch (positionType[mapY][mapX]) {     // Erase the last position of the stork
-    case GRASS:     // Grass                // depends on the type of the position
-        color = GRASS_COLOR;
-        break;
-    case ROAD:      // Road
-        color = ROAD_COLOR;
-        break;
-    case DESTINATION:    // Destination
-        color = DESTINATION_COLOR;
-        break;
-    case OBSTACLE:         // Obstacle
-        color = OBSTACLE_COLOR;
-        ch = OBSTACLE_SIGN;
-        break;
-    case COIN:    // Coin
-        color = COIN_COLOR;
-        ch = COIN_SIGN;
-        break;
+    double seconds = NowSeconds() - start;
+    printf("seed: %llu\n", options->seed);
+    printf("ticks: %lld\n", ticks);
+    printf("rounds: %lld (won %lld, car %lld, stork %lld, unfinished %lld)\n", rounds,
+        results[ROUND_WON], results[ROUND_CAR_HIT], results[ROUND_STORK_HIT], results[ROUND_RUNNING]);
+    if (config->endless) {
+        printf("best distance: %d\n", bestDistance);
+    }
+    printf("seconds: %.3f\n", seconds);
+    printf("ticks/s: %.0f\n", seconds > 0 ? ticks / seconds : 0.0);
+    printf("ns/tick: %.0f\n", ticks > 0 ? stepSeconds * 1e9 / ticks : 0.0);
+    printf("arena: %zu KB, %lld heap blocks\n", (arenaBytes + 1023) / 1024, arenaBlocks);
+    printf("heap allocations: %lld in ticks, %lld in setup after the first round, %lld held after the run\n",
+        tickAllocations, setupAllocations, HeapBlocksHeld() - heldBefore);
+    if (input->hashCount > 0) {
+        if (input->desyncTick >= 0) printf("replay: %d state hashes checked, differs from tick %d\n", input->hashesChecked, input->desyncTick);
+        else printf("replay: %d state hashes checked, all the same\n", input->hashesChecked);
+    }
+    return input->desyncTick < 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int CompareCarKernels(const CARS* cars, const CAR_STEP* step, const unsigned long long* touch, unsigned long long* scratch) {
+    int words = (cars->count + 63) / 64;
+    unsigned long long* shift = scratch;            // Scalar results first, then the other kernels' in turn
+    unsigned long long* visit = scratch + words;
+    unsigned long long* otherShift = scratch + 2 * words;
+    unsigned long long* otherVisit = scratch + 3 * words;
+    StepCarsScalar(cars, step, touch, shift, visit);
+    int mismatches = 0;
+    for (int k = 1; k < CAR_KERNEL_SET_COUNT; k++) {
+        if (!CarKernelsSupported(&CAR_KERNEL_SETS[k])) {
+            continue;
+        }
+        CAR_KERNEL_SETS[k].stepCars(cars, step, touch, otherShift, otherVisit);
+        for (int w = 0; w < words; w++) {
+            if (otherShift[w] != shift[w] || otherVisit[w] != visit[w]) {
+                mismatches++;
+                fprintf(stderr, "%s differs from scalar: word %d of %d cars, shift %016llx/%016llx visit %016llx/%016llx\n",
+                    CAR_KERNEL_SETS[k].name, w, cars->count, otherShift[w], shift[w], otherVisit[w], visit[w]);
+            }
+        }
+    }
+    return mismatches;
+}
+
+CAR_STEP StepOfTick(CARS* cars, TIMER* timer, FROG* frog, int width) {
+    int dueCount = 0;
+    for (int s = 1; s <= cars->maxSpeed; s++) {
+        cars->dueBySpeed[s] = (timer->carsTime % s == 0);
+        if (cars->dueBySpeed[s]) cars->dueSpeeds[dueCount++] = s;
+    }
+    CAR_STEP step = { cars->dueBySpeed, cars->dueSpeeds, dueCount, frog->x, frog->y, frog->carried ? frog->carringCar : -1, width };
+    return step;
+}
+
+void RandomCars(CARS* cars, RNG* rng, int count, int width, int carLength) {
+    cars->count = count;
+    for (int i = 0; i < count; i++) {           // Around the edges, the frog and the speed change cells on purpose
+        cars->y[i] = Random(rng, 4);
+        cars->x[i] = Random(rng, width + 16) - 8;
+        cars->length[i] = Random(rng, carLength) + 1;
+        cars->direction[i] = Random(rng, 2) ? 1 : -1;
+        cars->speed[i] = Random(rng, cars->maxSpeed) + 1;
+        cars->xSpeedChange[i] = Random(rng, 4) ? Random(rng, width) : cars->x[i] + cars->direction[i];
+        cars->flags[i] = (unsigned char)Random(rng, 4);
+    }
+    for (int w = 0; w < cars->words; w++) {
+        cars->touch[w] = NextRandom(rng) & NextRandom(rng) & NextRandom(rng);     // About one car in 8
+    }
+}
+
+int RunKernelCheck(OPTIONS* options, INPUT* input, CONFIG* config) {
+    ARENA arena;
+    InitArena(&arena);
+    ARENA scratchArena;
+    InitArena(&scratchArena);
+    GAME game;
+    game.config = *config;
+    game.arena = &arena;
+    game.profiler = NULL;
+    game.spectator = NULL;
+    input->randomPolicy = true;                 // The random frog gets carried and waits next to cars
+
+    int fuzzCapacity = 1024;
+    CARS fuzz;
+    fuzz.capacity = fuzzCapacity;
+    fuzz.maxSpeed = config->carSpeed;
+    fuzz.x = ArenaArray<int>(&scratchArena, fuzzCapacity);
+    fuzz.y = ArenaArray<int>(&scratchArena, fuzzCapacity);
+    fuzz.length = ArenaArray<int>(&scratchArena, fuzzCapacity);
+    fuzz.direction = ArenaArray<int>(&scratchArena, fuzzCapacity);
+    fuzz.speed = ArenaArray<int>(&scratchArena, fuzzCapacity);
+    fuzz.xSpeedChange = ArenaArray<int>(&scratchArena, fuzzCapacity);
+    fuzz.flags = ArenaArray<unsigned char>(&scratchArena, fuzzCapacity);
+    fuzz.dueBySpeed = ArenaArray<unsigned char>(&scratchArena, config->carSpeed + 1);
+    fuzz.dueSpeeds = ArenaArray<int>(&scratchArena, config->carSpeed);
+    fuzz.words = fuzzCapacity / 64;
+    fuzz.touch = ArenaArray<unsigned long long>(&scratchArena, fuzz.words);
+    unsigned long long* fuzzScratch = ArenaArray<unsigned long long>(&scratchArena, 4 * fuzz.words);
+
+    long long ticks = 0;
+    long long sets = 0;
+    int mismatches = 0;
+    for (int n = 0; n < options->checkKernels; n++) {
+        game.seed = options->seed + n;
+        InitRound(&game, NULL);
+        RewindInput(input);
+        SeedPolicy(input, game.seed);
+        unsigned long long* scratch = ArenaArray<unsigned long long>(game.arena, 4 * game.cars->words);
+        int width = game.playwin->width;
+        for (long long tick = 0; tick < options->roundTicks && RoundState(game.frog, game.storks, game.cars, game.timer, game.occupancy, game.map) == ROUND_RUNNING; tick++) {
+            CAR_STEP step = StepOfTick(game.cars, game.timer, game.frog, width);     // Every state the round goes through
+            mismatches += CompareCarKernels(game.cars, &step, game.cars->touch, scratch);
+            StepGame(&game, input);
+            ticks++;
+        }
+        CleanupRound(&game);
+
+        RNG rng;
+        SeedRandom(&rng, game.seed);
+        for (int set = 0; set < 64; set++) {
+            RandomCars(&fuzz, &rng, Random(&rng, fuzzCapacity) + 1, config->cols, config->carLength);
+            TIMER timer;
+            timer.carsTime = Random(&rng, config->carSpeed * config->carSpeed) + 1;
+            FROG frog;
+            frog.x = Random(&rng, config->cols);
+            frog.y = Random(&rng, 4);
+            frog.carried = Random(&rng, 2) == 1;
+            frog.carringCar = Random(&rng, fuzz.count);
+            CAR_STEP step = StepOfTick(&fuzz, &timer, &frog, config->cols);
+            mismatches += CompareCarKernels(&fuzz, &step, fuzz.touch, fuzzScratch);
+            sets++;
+        }
+    }
+    FreeArena(&scratchArena);
+    FreeArena(&arena);
+
+    printf("kernels:");
+    for (int k = 0; k < CAR_KERNEL_SET_COUNT; k++) {
+        if (CarKernelsSupported(&CAR_KERNEL_SETS[k])) printf(" %s", CAR_KERNEL_SETS[k].name);
+    }
+    printf(" (playing with %s)\n", carKernels.name);
+    printf("checked: %d seeds, %lld ticks, %lld random car sets\n", options->checkKernels, ticks, sets);
+    printf("mismatches: %d\n", mismatches);
+    return mismatches == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int RunStateCheck(OPTIONS* options, INPUT* input, CONFIG* config) {
+    ARENA arena;
+    InitArena(&arena);
+    ARENA shadowArena;
+    InitArena(&shadowArena);
+    GAME game;
+    game.config = *config;
+    game.arena = &arena;
+    game.profiler = NULL;
+    game.spectator = NULL;
+    GAME shadow = game;                         // Loaded from the ring, then played to where the game is
+    shadow.arena = &shadowArena;
+    input->randomPolicy = true;                 // The random frog gets carried, takes coins and loses
+    REWIND rewind;
+    InitRewind(&rewind);
+
+    long long ticks = 0;
+    long long loads = 0;
+    long long rewinds = 0;
+    long long replayed = 0;                     // Ticks played again after a load or a rewind
+    long long hashes = 0;                       // Kept state hashes checked against a full pass
+    size_t memory = 0;
+    int mismatches = 0;
+    for (int n = 0; n < options->checkState; n++) {
+        game.seed = options->seed + n;
+        shadow.seed = game.seed;
+        InitRound(&game, NULL);
+        InitRound(&shadow, NULL);
+        RewindInput(input);
+        SeedPolicy(input, game.seed);
+        StartRewind(&rewind, &game, input->tick);
+        size_t words = rewind.stateBytes / 8;
+        unsigned long long* now = ArenaArray<unsigned long long>(game.arena, words);
+        unsigned long long* loaded = ArenaArray<unsigned long long>(game.arena, words);
+        int windowTicks = REWIND_SECONDS * 1000 / game.timer->frameRate;
+        RNG rng;
+        SeedRandom(&rng, game.seed);
+
+        INPUT marked = *input;                  // Input at the tick the next check goes back to
+        int span = Random(&rng, windowTicks) + 1;
+        for (long long tick = 0; tick < options->roundTicks && RoundState(game.frog, game.storks, game.cars, game.timer, game.occupancy, game.map) == ROUND_RUNNING; tick++) {
+            StepGame(&game, input);
+            PushRewind(&rewind, &game, input->tick);
+            ticks++;
+            if (input->tick - marked.tick < span) {
+                continue;
+            }
+            memcpy(now, rewind.last, rewind.stateBytes);
+            unsigned long long hash = StateHash(&game);
+            if (hash != RehashState(&game)) {
+                mismatches++;
+                fprintf(stderr, "seed %llu: state hash drifted by tick %d\n", game.seed, input->tick);
+            }
+            hashes++;
+
+            INPUT shadowInput = marked;         // A copy loaded from the ring plays on to this tick
+            long long loadedTick;
+            DecodeRewind(&rewind, marked.tick, loaded, false);
+            if (!LoadState(&shadow, (unsigned char*)loaded, &loadedTick) || loadedTick != marked.tick) {
+                mismatches++;
+                fprintf(stderr, "seed %llu: tick %d is not in the ring\n", game.seed, marked.tick);
+            }
+            else {
+                while (shadowInput.tick < input->tick) {
+                    StepGame(&shadow, &shadowInput);
+                    replayed++;
+                }
+                SaveState(&shadow, shadowInput.tick, (unsigned char*)loaded);
+                if (memcmp(loaded, now, rewind.stateBytes) != 0 || StateHash(&shadow) != hash
+                    || memcmp(shadow.occupancy->bits, game.occupancy->bits, sizeof(unsigned long long) * game.occupancy->rows * game.occupancy->words) != 0) {
+                    mismatches++;
+                    fprintf(stderr, "seed %llu: loaded at tick %d, differs at tick %d\n", game.seed, marked.tick, input->tick);
+                }
+            }
+            loads++;
+
+            if (loads % 2 == 0) {               // Every other check the game itself goes back and plays again
+                int tickNow = input->tick;
+                long long rewoundTick = DecodeRewind(&rewind, marked.tick, rewind.last, true);
+                LoadState(&game, (unsigned char*)rewind.last, &rewoundTick);
+                *input = marked;
+                while (input->tick < tickNow) {
+                    StepGame(&game, input);
+                    PushRewind(&rewind, &game, input->tick);
+                    replayed++;
+                }
+                if (memcmp(rewind.last, now, rewind.stateBytes) != 0 || StateHash(&game) != hash) {
+                    mismatches++;
+                    fprintf(stderr, "seed %llu: rewound to tick %d, differs at tick %d\n", game.seed, marked.tick, input->tick);
+                }
+                rewinds++;
+            }
+            marked = *input;
+            span = Random(&rng, windowTicks) + 1;
+        }
+        memory = max(memory, RewindMemory(&rewind));
+        CleanupRound(&game);
+        CleanupRound(&shadow);
+    }
+    FreeArena(&shadowArena);
+    FreeArena(&arena);
+
+    long long records = rewind.keyframes + rewind.deltas;      // Of the last round, the ring starts again every round
+    double ticksPerSecond = 1000.0 / FRAME_RATE;
+    double bytesPerTick = records > 0 ? double(rewind.keyframeBytes + rewind.deltaBytes + 4 * records) / records : 0;
+    printf("checked: %d seeds, %lld ticks, %lld loads and %lld rewinds (%lld ticks played again)\n",
+        options->checkState, ticks, loads, rewinds, replayed);
+    printf("state: %zu bytes, keyframe %lld bytes, delta %.0f bytes per tick\n", rewind.stateBytes,
+        rewind.keyframes > 0 ? rewind.keyframeBytes / rewind.keyframes : 0LL, rewind.deltas > 0 ? double(rewind.deltaBytes) / rewind.deltas : 0.0);
+    printf("rewind: %.1f KB per second of play, %zu KB held for the last %d s\n", bytesPerTick * ticksPerSecond / 1024,
+        (memory + 1023) / 1024, REWIND_SECONDS);
+    printf("hashes: %lld state hashes checked against a full pass\n", hashes);
+    printf("mismatches: %d\n", mismatches);
+    FreeRewind(&rewind);
+    return mismatches == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+//------------------------------------------------
+//--------------  AUTOPILOT FUNCTIONS ------------
+//------------------------------------------------
+
+struct PLAN_STATE {             // Frog after some ticks of a route
+    int cell;                   // y * cols + x
+    int parent;                 // State one tick earlier (-1 for the start)
+    unsigned char moves;
+    unsigned char ready;        // Did not move on the previous tick, so the cooldown is over
+    unsigned char key;          // REPLAY_KEYS code pressed on the tick that led here (0 = none)
+    unsigned short coins;
+};
+
+struct PLAN {
+    int ticks;                  // Ticks to reach the destination (-1 if there is no route)
+    int coins;                  // Coins picked up on the way
+    unsigned char* keys;        // REPLAY_KEYS code per tick
+    long long states;           // Search states kept
+    double seconds;
+};
+
+struct PLANNER {
+    GAME model;                 // The round played without a frog: where every car is on every tick
+    int rows;
+    int cols;
+    int maxMoves;
+    PLAN_STATE* states;         // Every tick's states, one tick after the other
+    int count;
+    int capacity;
+    int* seen;                  // Per (cell, ready): state in the tick being built
+    int* seenTick;
+    int* settled;               // Tick a cell off the roads first held a frog with every move and no cooldown (-1 = never)
+    int* minTicks;              // Fewest ticks to climb d rows, by (d, moves, ready, tick within the second)
+    int phases;                 // Ticks per second
+    int bound;                  // Routes must arrive by this tick
+    int overBound;              // Earliest arrival of the states cut by the bound
+    ARENA arena;                // Of the model, reused by every search
+};
+
+bool OffRoad(MAP* map, int y, int x) {
+    return MapCell(map, y, x) != ROAD;      // Nothing can hit the frog there (storks aside)
+}
+
+bool StopsFriendlyCar(GAME* model, int y, int x) {
+    for (int cell = x - CAR_MAX_DISTANCE_FROM_FROG; cell <= x + CAR_MAX_DISTANCE_FROM_FROG; cell++) {
+        int car = CarOnCell(model->occupancy, y, cell);                         // Friendly cars wait for a frog close by,
+        if (car >= 0 && !(model->cars->flags[car] & CAR_ALWAYS_MOVE)) {        // which the lane model can't follow,
+            return true;                                                        // so routes never get that close
+        }
     }
+    return false;
+}
 
-    wattron(stork->win->window, COLOR_PAIR(color));
-    mvwaddch(stork->win->window, mapY, mapX, ch);
-    wattroff(stork->win->window, COLOR_PAIR(color));
-    wrefresh(stork->win->window);
+bool EnemyCarOn(GAME* model, int y, int x) {
+    int car = CarOnCell(model->occupancy, y, x);
+    return car >= 0 && (model->cars->flags[car] & CAR_ALWAYS_MOVE);
 }
 
-void DrawStork(STORK* stork) {
-    wattron(stork->win->window, COLOR_PAIR(stork->color));
-    mvwaddch(stork->win->window, stork->y, stork->x, stork->sign);      // Draw stork in the new position
-    wattroff(stork->win->window, COLOR_PAIR(stork->color));
-    wrefresh(stork->win->window);
+int MinTicksSlot(PLANNER* planner, int rows, int moves, int ready, int phase) {
+    return ((rows * (planner->maxMoves + 1) + moves) * 2 + ready) * planner->phases + phase;
+}
+
+void InitMinTicks(PLANNER* planner) {
+    planner->phases = MAX_FRAME_RATE / FRAME_RATE;
+    planner->minTicks = new int[planner->rows * (planner->maxMoves + 1) * 2 * planner->phases];
+    for (int rows = 0; rows < planner->rows; rows++) {
+        for (int moves = 0; moves <= planner->maxMoves; moves++) {
+            for (int ready = 0; ready <= 1; ready++) {
+                for (int phase = 0; phase < planner->phases; phase++) {
+                    if (rows == 0) {
+                        planner->minTicks[MinTicksSlot(planner, 0, moves, ready, phase)] = 0;
+                        continue;
+                    }
+                    int m = moves;          // Moving up as soon as the budget and the cooldown allow is the fastest,
+                    int r = ready;          // obstacles, cars and side steps only add to it
+                    int p = phase;
+                    int ticks = 0;
+                    while (true) {
+                        if (p == planner->phases - 1 && m < planner->maxMoves) m++;
+                        ticks++;
+                        p = (p + 1) % planner->phases;
+                        if (r && m > 0) break;
+                        r = 1;
+                    }
+                    planner->minTicks[MinTicksSlot(planner, rows, moves, ready, phase)] = ticks + planner->minTicks[MinTicksSlot(planner, rows - 1, m - 1, 0, p)];
+                }
+            }
+        }
+    }
 }
 
-void MoveStork(STORK* stork, FROG* frog, TIMER* timer, int** positionType) {
-    if (timer->time < stork->timeToStork) {
-        return;                     // Start moving stork after the delay
+void AddPlanState(PLANNER* planner, int tick, int cell, int moves, int ready, int key, int coins, int parent) {
+    int x = cell % planner->cols;
+    int y = cell / planner->cols;
+    MAP* map = planner->model.map;
+    int arrival = tick + planner->minTicks[MinTicksSlot(planner, y - 1, moves, ready, tick % planner->phases)];
+    if (arrival > planner->bound) {
+        if (arrival < planner->overBound) planner->overBound = arrival;
+        return;                     // Can't make it in time, maybe with a larger bound
     }
-    else if (timer->time == 5) {
-        DrawStork(stork);       // Start drawing stork after 5 seconds
+    if (OffRoad(map, y, x)) {
+        if (planner->settled[cell] >= 0 && !(moves == planner->maxMoves && ready)) {
+            return;                 // A frog waiting here since an earlier tick is at least as good
+        }
+    }
+    else if (StopsFriendlyCar(&planner->model, y, x)) {
         return;
     }
 
-    clock_t currentTime = clock();
-    double timeDiff = double(currentTime - stork->lastMoveTime) / CLOCKS_PER_SEC;
-
-    DrawStork(stork);
+    int slot = cell * 2 + ready;
+    if (planner->seenTick[slot] == tick) {
+        PLAN_STATE* state = &planner->states[planner->seen[slot]];      // Same cell and cooldown this tick, keep the better one
+        if (moves > state->moves || (moves == state->moves && coins > state->coins)) {
+            state->moves = (unsigned char)moves;
+            state->key = (unsigned char)key;
+            state->coins = (unsigned short)coins;
+            state->parent = parent;
+        }
+        return;
+    }
+    if (planner->count == planner->capacity) {
+        planner->capacity *= 2;
+        PLAN_STATE* states = new PLAN_STATE[planner->capacity];
+        memcpy(states, planner->states, sizeof(PLAN_STATE) * planner->count);
+        delete[] planner->states;
+        planner->states = states;
+    }
+    planner->seenTick[slot] = tick;
+    planner->seen[slot] = planner->count;
+    PLAN_STATE* state = &planner->states[planner->count++];
+    state->cell = cell;
+    state->parent = parent;
+    state->moves = (unsigned char)moves;
+    state->ready = (unsigned char)ready;
+    state->key = (unsigned char)key;
+    state->coins = (unsigned short)coins;
+}
 
-    if (timeDiff < 2) {
-        return;         // Strork moves every 2 seconds
+bool Settled(PLANNER* planner, int y, int x) {
+    if (x < 1 || x > planner->cols - 2 || y < 1 || y > planner->rows - 2 || MapCell(planner->model.map, y, x) == OBSTACLE) {
+        return true;                // Nowhere to go
     }
+    return OffRoad(planner->model.map, y, x) && planner->settled[y * planner->cols + x] >= 0;
+}
 
-    EraseStork(stork, positionType);    // Erase the last position of the stork
+void ExpandPlanState(PLANNER* planner, int tick, int i, bool regen) {
+    PLAN_STATE state = planner->states[i];
+    int x = state.cell % planner->cols;
+    int y = state.cell / planner->cols;
+    int moves = (regen && state.moves < planner->maxMoves) ? state.moves + 1 : state.moves;   // Timer runs before the frog
+    MAP* map = planner->model.map;
 
-    if (stork->x < frog->x) {
-        stork->x++;
-    }                                       // Stork moves behind the frog (vertical, horizontal and diagonal movement)
-    else if (stork->x > frog->x) {
-        stork->x--;
+    if (moves == planner->maxMoves && state.ready && OffRoad(map, y, x) && Settled(planner, y - 1, x)
+        && Settled(planner, y + 1, x) && Settled(planner, y, x - 1) && Settled(planner, y, x + 1)) {
+        return;                     // Every step from here leads where a frog is already waiting, nothing new to reach
     }
 
-    if (stork->y < frog->y) {
-        stork->y++;
+    AddPlanState(planner, tick, state.cell, moves, 1, 0, state.coins, i);      // Wait
+    if (!state.ready || moves == 0) {
+        return;
+    }
+    const int stepX[] = { 0, 0, 0, -1, 1 };         // Indexed by REPLAY_KEYS code
+    const int stepY[] = { 0, -1, 1, 0, 0 };
+    for (int code = 1; code <= 4; code++) {
+        int newX = x + stepX[code];
+        int newY = y + stepY[code];
+        if (newX < 1 || newX > planner->cols - 2 || newY < 1 || newY > planner->rows - 2 || MapCell(map, newY, newX) == OBSTACLE) {
+            continue;               // CheckFrogMove would refuse it, same as waiting
+        }
+        int coins = state.coins + (MapCell(map, newY, newX) == COIN ? 1 : 0);
+        AddPlanState(planner, tick, newY * planner->cols + newX, moves - 1, 0, code, coins, i);
     }
-    else if (stork->y > frog->y) {
-        stork->y--;
+}
+
+void FinishPlan(PLANNER* planner, PLAN* plan, int goal, int ticks) {
+    plan->ticks = ticks;
+    plan->coins = planner->states[goal].coins;
+    plan->keys = new unsigned char[ticks > 0 ? ticks : 1];
+    for (int i = goal, t = ticks - 1; t >= 0; i = planner->states[i].parent, t--) {
+        plan->keys[t] = planner->states[i].key;         // Back from the goal to the start
     }
+}
 
-    DrawStork(stork);    // Draw the stork in the new position
+bool SearchPlan(PLANNER* planner, CONFIG* config, unsigned long long seed, int maxTicks, PLAN* plan) {
+    planner->model.config = *config;
+    planner->model.seed = seed;
+    planner->model.profiler = NULL;
+    planner->model.spectator = NULL;
+    planner->model.arena = &planner->arena;
+    InitRound(&planner->model, NULL);                   // Same seed, so the same map and the same cars
+    planner->count = 0;
+    int cells = planner->rows * planner->cols;
+    for (int i = 0; i < 2 * cells; i++) planner->seenTick[i] = -1;
+    for (int i = 0; i < cells; i++) planner->settled[i] = -1;
+    planner->overBound = INT_MAX;
+
+    FROG* frog = planner->model.frog;
+    AddPlanState(planner, 0, frog->y * planner->cols + frog->x, frog->remainingMoves, 1, 0, 0, -1);
+    frog->x = -1000;                                    // The model's own frog leaves the board, so no car ever waits for it
+    frog->y = -1000;
+
+    bool found = false;
+    int first = 0;
+    for (int tick = 0; tick < maxTicks && first < planner->count && !found; tick++) {
+        int last = planner->count;                      // States of this tick: first .. last - 1
+        bool regen = (tick + 1) % planner->phases == 0;
+        for (int i = first; i < last; i++) {
+            ExpandPlanState(planner, tick + 1, i, regen);
+        }
+
+        Timer(planner->model.timer, planner->model.frog);   // The cars of the next tick
+        MoveCars(planner->model.playwin, planner->model.cars, &planner->model.rng, planner->model.timer, planner->model.frog,
+            planner->model.occupancy, config->carLength, config->carSpeed, CARM_COLOR, CARS_COLOR);
+
+        int kept = last;
+        int goal = -1;
+        for (int i = last; i < planner->count; i++) {
+            PLAN_STATE state = planner->states[i];
+            int x = state.cell % planner->cols;
+            int y = state.cell / planner->cols;
+            if (EnemyCarOn(&planner->model, y, x)) {
+                continue;                               // Hit after the cars moved
+            }
+            planner->states[kept] = state;
+            if (MapCell(planner->model.map, y, x) == DESTINATION && (goal < 0 || state.coins > planner->states[goal].coins)) {
+                goal = kept;
+            }
+            if (state.moves == planner->maxMoves && state.ready && planner->settled[state.cell] < 0 && OffRoad(planner->model.map, y, x)) {
+                planner->settled[state.cell] = tick + 1;
+            }
+            kept++;
+        }
+        planner->count = kept;
+        first = last;
+        if (goal >= 0) {
+            FinishPlan(planner, plan, goal, tick + 1);  // Ticks go one at a time, so the first route found is the fastest
+            found = true;
+        }
+    }
+    plan->states += planner->count;
+    CleanupRound(&planner->model);
+    return found;
+}
 
-    stork->lastMoveTime = currentTime;      // Update the last move time
+void PlanRound(CONFIG* config, unsigned long long seed, int maxTicks, PLAN* plan) {
+    double start = NowSeconds();
+    PLANNER planner;
+    planner.rows = config->rows;
+    planner.cols = config->cols;
+    planner.maxMoves = config->frogMoves;
+    int cells = config->rows * config->cols;
+    planner.capacity = 4 * cells;
+    planner.states = new PLAN_STATE[planner.capacity];
+    planner.seen = new int[2 * cells];
+    planner.seenTick = new int[2 * cells];
+    planner.settled = new int[cells];
+    InitMinTicks(&planner);
+    InitArena(&planner.arena);
+
+    plan->ticks = -1;
+    plan->coins = 0;
+    plan->keys = NULL;
+    plan->states = 0;
+    planner.bound = 0;                                  // Raised until a route fits, the first one found is still the fastest
+    while (!SearchPlan(&planner, config, seed, maxTicks, plan) && planner.overBound < maxTicks) {
+        int step = planner.bound / 64 > 8 ? planner.bound / 64 : 8;
+        planner.bound = (planner.overBound > planner.bound + step) ? planner.overBound : planner.bound + step;
+    }
 
+    plan->seconds = NowSeconds() - start;
+    delete[] planner.states;
+    delete[] planner.seen;
+    delete[] planner.seenTick;
+    delete[] planner.settled;
+    delete[] planner.minTicks;
+    FreeArena(&planner.arena);
 }
 
+void FreePlan(PLAN* plan) {
+    delete[] plan->keys;
+    plan->keys = NULL;
+}
 
-bool StorkColision(FROG* frog, STORK* stork, TIMER* timer) {
-    if (timer->time < stork->timeToStork) {         // Start checking collision after 5 seconds
-        return false;
+void PlanToScript(PLAN* plan, INPUT* input) {
+    FreeInput(input);
+    input->scriptTicks = new int[plan->ticks > 0 ? plan->ticks : 1];
+    input->scriptKeys = new int[plan->ticks > 0 ? plan->ticks : 1];
+    input->scriptCount = 0;
+    for (int t = 0; t < plan->ticks; t++) {
+        if (plan->keys[t] != 0) {
+            input->scriptTicks[input->scriptCount] = t;
+            input->scriptKeys[input->scriptCount] = REPLAY_KEYS[plan->keys[t]];
+            input->scriptCount++;
+        }
     }
+    input->scriptPos = 0;
+}
 
-    if (frog->y == stork->y && frog->x == stork->x && frog->carried == false) {         // Check colision with stork
-        return true;
+int RunAutopilot(OPTIONS* options, CONFIG* config) {
+    if (config->endless) {
+        cerr << "The autopilot needs a destination, it can't play endless rounds" << endl;
+        return EXIT_FAILURE;
     }
-    return false;
+    long long rounds = (options->rounds > 0) ? options->rounds : 1;
+    long long solved = 0;
+    long long verified = 0;
+    INPUT input;
+    InitKeyboardInput(&input);
+    ARENA arena;
+    InitArena(&arena);
+    for (long long round = 0; round < rounds; round++) {
+        unsigned long long seed = options->seed + round;
+        PLAN plan;
+        PlanRound(config, seed, int(options->roundTicks), &plan);
+        if (plan.ticks < 0) {
+            printf("seed %llu: no route within %lld ticks (%lld states, %.2f ms)\n", seed, options->roundTicks, plan.states, plan.seconds * 1e3);
+            continue;
+        }
+        solved++;
+
+        GAME game;                                      // Play the route by the real rules
+        game.config = *config;
+        game.seed = seed;
+        game.arena = &arena;
+        game.profiler = NULL;
+        game.spectator = NULL;
+        InitRound(&game, NULL);
+        PlanToScript(&plan, &input);
+        RewindInput(&input);
+        int state;
+        int ticks = 0;
+        while ((state = RoundState(game.frog, game.storks, game.cars, game.timer, game.occupancy, game.map)) == ROUND_RUNNING && ticks < plan.ticks) {
+            StepGame(&game, &input);
+            ticks++;
+        }
+        const char* result = (state == ROUND_WON) ? "won" : (state == ROUND_CAR_HIT) ? "car" : (state == ROUND_STORK_HIT) ? "stork" : "unfinished";
+        if (state == ROUND_WON) verified++;
+        printf("seed %llu: solvable in %d ticks, %d coins (%lld states, %.2f ms), played: %s in %d ticks, %d coins\n",
+            seed, plan.ticks, plan.coins, plan.states, plan.seconds * 1e3, result, ticks, game.frog->points);
+        CleanupRound(&game);
+        FreePlan(&plan);
+    }
+    printf("solved: %lld/%lld, won when played: %lld\n", solved, rounds, verified);
+    FreeArena(&arena);
+    FreeInput(&input);
+    return EXIT_SUCCESS;
 }
 
 //------------------------------------------------
-//---------------  TIMER FUNCTIONS ---------------
+//---------------  SESSION FUNCTIONS -------------
 //------------------------------------------------
 
-TIMER* InitTimer(WIN* w, int startTime, int frameRate, int maxFrameRate, int checkFrameRate, int carTime) {
-    TIMER* timer = new TIMER;
-    timer->time = startTime;
-    timer->frameRate = frameRate;
-    timer->maxFrameRate = maxFrameRate;
-    timer->checkFrameRate = checkFrameRate;
-    timer->carsTiming = carTime;
-    timer->carsTime = carTime;
-    return timer;
+struct NEXT_ROUND {             // Built on a worker thread while the result screen of the last round shows
+    GAME game;                  // Headless until StartRound gives it the session's windows
+    PLAN plan;                  // Autopilot route (ticks -1 if none)
+    bool autopilot;
+    int roundTicks;
+    std::thread worker;
+};
+
+void BuildNextRound(NEXT_ROUND* next) {
+    InitRound(&next->game, NULL);                       // No curses calls off the main thread
+    next->plan.ticks = -1;
+    next->plan.keys = NULL;
+    if (next->autopilot && !next->game.config.endless) {
+        PlanRound(&next->game.config, next->game.seed, next->roundTicks, &next->plan);
+    }
 }
 
-void Timer(TIMER* timer, FROG* frog) {
-    timer->checkFrameRate += timer->frameRate;
-    if (timer->checkFrameRate >= timer->maxFrameRate) {             // Update time and avaliable moves during the game
-        timer->time++;
-        timer->checkFrameRate = 0;
-        if (frog->remainingMoves < frog->maxMoves) {
-            frog->remainingMoves++;
-        }
+void StartNextRound(NEXT_ROUND* next, CONFIG* config, unsigned long long seed, OPTIONS* options, ARENA* arena) {
+    next->game.config = *config;
+    next->game.seed = seed;
+    next->game.arena = arena;                           // Not the arena of the round still on screen
+    next->game.profiler = NULL;
+    next->game.spectator = NULL;
+    next->game.leaderboard = NULL;
+    next->autopilot = options->autopilot;
+    next->roundTicks = int(options->roundTicks);
+    next->worker = std::thread(BuildNextRound, next);
+}
+
+void FinishNextRound(NEXT_ROUND* next) {
+    next->worker.join();                                // Usually done long before the player asks for it
+}
+
+void DropNextRound(NEXT_ROUND* next) {
+    FinishNextRound(next);
+    FreePlan(&next->plan);
+    CleanupRound(&next->game);
+}
+
+void StartRound(GAME* game, NEXT_ROUND* next, WIN* playwin, WIN* statwin, INPUT* input) {
+    PROFILER* profiler = game->profiler;
+    SPECTATOR* spectator = game->spectator;
+    LEADERBOARD* leaderboard = game->leaderboard;
+    *game = next->game;                                 // Swap in the built round, no generation on this thread
+    game->profiler = profiler;
+    game->spectator = spectator;
+    game->leaderboard = leaderboard;
+    game->playwin->renderer = playwin->renderer;        // Same windows every round, so no flicker
+    game->playwin->window = playwin->window;
+    game->statwin->renderer = statwin->renderer;
+    game->statwin->window = statwin->window;
+
+    if (next->plan.ticks >= 0) {
+        PlanToScript(&next->plan, input);               // The bot plays the round
+    }
+    else if (next->autopilot) {
+        FreeInput(input);                               // No route found: the player does, not the last round's route
+    }
+    FreePlan(&next->plan);
+    if (game->spectator != NULL) {
+        SpectateRound(game->spectator, game);
     }
 
-    timer->carsTime--;
-    if (timer->carsTime <= 0) {
-        timer->carsTime = timer->carsTiming;
+    DrawGame(game->playwin, game->statwin, &game->stats, &game->frame, game->frog, game->timer, game->roadPositions, game->map,
+        game->config.carsAndRoads, game->config.rows, game->config.cols);           // Draw map and game elements
+}
+
+void EndRound(GAME* game) {
+    game->playwin->renderer = NULL_RENDERER;            // The windows stay for the next round
+    game->playwin->window = NULL;
+    game->statwin->renderer = NULL_RENDERER;
+    game->statwin->window = NULL;
+    CleanupRound(game);
+}
+
+bool PlayAgain(WIN* playwin, bool canContinue) {
+    RENDERER* renderer = playwin->renderer;
+    renderer->dropKeys(renderer);                       // Keys still pressed from the round don't count
+    if (canContinue) {
+        Print(playwin, 7, 1, "Enter: play again");
+    }
+    Print(playwin, 8, 1, "Q: quit");
+    renderer->stage(playwin);
+    renderer->update(renderer);
+    while (true) {
+        int key = renderer->readKey(playwin);
+        if (canContinue && (key == '\n' || key == KEY_ENTER)) return true;
+        if (key == 'q' || key == 'Q' || (!canContinue && key != ERR)) return false;
     }
 }
 
 //------------------------------------------------
-//---------------  STATS FUNCTIONS ---------------
+//----------------  BATCH FUNCTIONS --------------
 //------------------------------------------------
 
-void UpdateStats(WIN* w, FROG* frog, TIMER* timer) {
-    Timer(timer, frog);         // Update time and avaliable moves
+struct ROUND_RESULT {
+    unsigned char state;    // ROUND_*, ROUND_RUNNING if the round hit the tick limit
+    int ticks;
+    int coins;
+};
 
+struct BATCH {
+    CONFIG* configs;
+    int configCount;
+    long long rounds;               // Per config
+    long long roundTicks;
+    unsigned long long seed;
+    INPUT* input;                   // Copied by every worker
+    ROUND_RESULT* results;          // configCount * rounds, one slot per round so workers never share one
+    std::atomic<long long> next;    // Next round to play
+};
 
-    werase(w->window);
-    box(w->window, 0, 0);                                   // Show stats
-    mvwprintw(w->window, 1, 1, "Time: %d", timer->time);
-    mvwprintw(w->window, 2, 1, "Moves: %d", frog->remainingMoves);
-    mvwprintw(w->window, 3, 1, "Points: %d", frog->points);
-    mvwprintw(w->window, 5, 1, "Name: Maciej");
-    mvwprintw(w->window, 6, 1, "Surname: Drywa");
-    mvwprintw(w->window, 7, 1, "Index: 203556");
-    wrefresh(w->window);
+int* ConfigField(CONFIG* config, const char* name) {
+    if (strcmp(name, "rows") == 0) return &config->rows;
+    if (strcmp(name, "cols") == 0) return &config->cols;
+    if (strcmp(name, "roads") == 0) return &config->carsAndRoads;
+    if (strcmp(name, "car-speed") == 0) return &config->carSpeed;
+    if (strcmp(name, "car-length") == 0) return &config->carLength;
+    if (strcmp(name, "stork") == 0) return &config->timeToStork;
+    if (strcmp(name, "moves") == 0) return &config->frogMoves;
+    if (strcmp(name, "storks") == 0) return &config->storks;
+    if (strcmp(name, "cars-per-lane") == 0) return &config->carsPerLane;
+    return NULL;
 }
 
+int BuildSweep(OPTIONS* options, CONFIG* base, CONFIG** configs) {
+    int values[BATCH_MAX_SWEEPS][BATCH_MAX_VALUES];
+    int valueCount[BATCH_MAX_SWEEPS];
+    char names[BATCH_MAX_SWEEPS][32];
+    int total = 1;
+    for (int i = 0; i < options->sweepCount; i++) {             // "name=v1,v2,..."
+        const char* sweep = options->sweeps[i];
+        const char* equals = strchr(sweep, '=');
+        if (equals == NULL || equals - sweep >= 32) {
+            return 0;
+        }
+        memcpy(names[i], sweep, equals - sweep);
+        names[i][equals - sweep] = '\0';
+        if (ConfigField(base, names[i]) == NULL) {
+            return 0;
+        }
+        valueCount[i] = 0;
+        for (const char* value = equals + 1; *value != '\0' && valueCount[i] < BATCH_MAX_VALUES; value++) {
+            values[i][valueCount[i]++] = atoi(value);
+            value = strchr(value, ',');
+            if (value == NULL) break;
+        }
+        if (valueCount[i] == 0) {
+            return 0;
+        }
+        total *= valueCount[i];
+    }
 
-//------------------------------------------------
-//-------------  MAIN DRAW FUNCTIONS  -------------
-//------------------------------------------------
-
-void DrawMap(WIN* win, int** positionType, int rows, int cols) {
-    box(win->window, 0, 0);                   // Create the border
+    *configs = new CONFIG[total];
+    for (int c = 0; c < total; c++) {                           // Every combination of the swept values
+        (*configs)[c] = *base;
+        int rest = c;
+        for (int i = options->sweepCount - 1; i >= 0; i--) {
+            *ConfigField(&(*configs)[c], names[i]) = values[i][rest % valueCount[i]];
+            rest /= valueCount[i];
+        }
+    }
+    return total;
+}
 
-    for (int y = 1; y < rows - 1; y++) {
-        for (int x = 1; x < cols - 1; x++) {
-            switch (positionType[y][x]) {
-            case GRASS:                                                 // Draw grass
-                wattron(win->window, COLOR_PAIR(GRASS_COLOR));
-                mvwaddch(win->window, y, x, ' ');
-                wattroff(win->window, COLOR_PAIR(GRASS_COLOR));
-                break;
-            case ROAD:                                                                                            // Draw road  
-                wattron(win->window, COLOR_PAIR(ROAD_COLOR));
-                mvwaddch(win->window, y, x, ' ');
-                wattroff(win->window, COLOR_PAIR(ROAD_COLOR));
-                break;
-            case DESTINATION:                                                                              // Draw destination
-                wattron(win->window, COLOR_PAIR(DESTINATION_COLOR));
-                mvwaddch(win->window, y, x, ' ');
-                wattroff(win->window, COLOR_PAIR(DESTINATION_COLOR));
-                break;
-            case OBSTACLE:                                                                                // Draw obstacles
-                wattron(win->window, COLOR_PAIR(OBSTACLE_COLOR));
-                mvwaddch(win->window, y, x, OBSTACLE_SIGN);
-                wattroff(win->window, COLOR_PAIR(OBSTACLE_COLOR));
-                break;
+void BatchWorker(BATCH* batch) {
+    INPUT input = *batch->input;            // Own script position and policy generator
+    ARENA arena;                            // One block per worker, reused by all its rounds
+    InitArena(&arena);
+    GAME game;
+    game.arena = &arena;
+    game.profiler = NULL;
+    game.spectator = NULL;
+    long long total = batch->configCount * batch->rounds;
+    for (long long job = batch->next++; job < total; job = batch->next++) {
+        long long round = job % batch->rounds;
+        game.config = batch->configs[job / batch->rounds];
+        game.seed = batch->seed + round;        // The same seeds for every config, so configs are compared on the same rounds
+        InitRound(&game, NULL);
+        RewindInput(&input);
+        SeedPolicy(&input, game.seed);
+
+        int state;
+        int ticks = 0;
+        while ((state = RoundState(game.frog, game.storks, game.cars, game.timer, game.occupancy, game.map)) == ROUND_RUNNING && ticks < batch->roundTicks) {
+            StepGame(&game, &input);
+            ticks++;
+        }
+        batch->results[job].state = (unsigned char)state;
+        batch->results[job].ticks = ticks;
+        batch->results[job].coins = game.frog->points;
+        CleanupRound(&game);
+    }
+    FreeArena(&arena);
+}
 
-            case COIN:                                                                            // Draw coins
-                wattron(win->window, COLOR_PAIR(COIN_COLOR));
-                mvwaddch(win->window, y, x, COIN_SIGN);
-                wattroff(win->window, COLOR_PAIR(COIN_COLOR));
-                break;
+void WriteBatchCsv(FILE* out, BATCH* batch) {
+    fprintf(out, "rows,cols,roads,car_speed,car_length,stork,moves,storks,cars_per_lane,rounds,won,car,stork_hit,unfinished,win_rate,"
+        "coins_per_round,coin_rate,goal_ticks_mean,goal_ticks_p10,goal_ticks_p50,goal_ticks_p90\n");
+    int* goalTicks = new int[batch->rounds];
+    for (int c = 0; c < batch->configCount; c++) {
+        CONFIG* config = &batch->configs[c];
+        ROUND_RESULT* results = &batch->results[c * batch->rounds];
+        long long states[4] = { 0, 0, 0, 0 };
+        long long coins = 0;
+        long long won = 0;
+        double goalSum = 0;
+        for (long long r = 0; r < batch->rounds; r++) {
+            states[results[r].state]++;
+            coins += results[r].coins;
+            if (results[r].state == ROUND_WON) {
+                goalTicks[won++] = results[r].ticks;            // Time to goal only counts won rounds
+                goalSum += results[r].ticks;
             }
         }
+        std::sort(goalTicks, goalTicks + won);
+        double coinsPerRound = double(coins) / batch->rounds;
+        fprintf(out, "%d,%d,%d,%d,%d,%d,%d,%d,%d,%lld,%lld,%lld,%lld,%lld,%.4f,%.3f,%.4f,", config->rows, config->cols, config->carsAndRoads,
+            config->carSpeed, config->carLength, config->timeToStork, config->frogMoves, config->storks, config->carsPerLane, batch->rounds,
+            states[ROUND_WON], states[ROUND_CAR_HIT], states[ROUND_STORK_HIT], states[ROUND_RUNNING],
+            double(won) / batch->rounds, coinsPerRound, config->endless ? 0.0 : coinsPerRound / COINS_COUNT);
+        if (won > 0) {
+            fprintf(out, "%.1f,%d,%d,%d\n", goalSum / won, goalTicks[won / 10], goalTicks[won / 2], goalTicks[won * 9 / 10]);
+        }
+        else {
+            fprintf(out, ",,,\n");
+        }
     }
-    wrefresh(win->window);
+    delete[] goalTicks;
 }
 
+int RunBatch(OPTIONS* options, INPUT* input, CONFIG* config) {
+    BATCH batch;
+    batch.configCount = BuildSweep(options, config, &batch.configs);
+    if (batch.configCount == 0) {
+        cerr << "Bad --sweep, expected name=v1,v2,... with name rows, cols, roads, car-speed, car-length, stork, moves, storks or cars-per-lane" << endl;
+        return EXIT_FAILURE;
+    }
+    for (int c = 0; c < batch.configCount; c++) {
+        const char* configError = CheckConfig(&batch.configs[c]);
+        if (configError != NULL) {
+            cerr << "Invalid config in the sweep: " << configError << endl;
+            delete[] batch.configs;
+            return EXIT_FAILURE;
+        }
+    }
+    if (options->policy != NULL && strcmp(options->policy, "random") == 0) {
+        input->randomPolicy = true;
+    }
+    else if (options->policy != NULL && strcmp(options->policy, "script") != 0) {
+        cerr << "Unknown policy " << options->policy << " (random or script)" << endl;
+        delete[] batch.configs;
+        return EXIT_FAILURE;
+    }
 
-void DrawGame(WIN* playwin, WIN* statwin, FROG* frog, TIMER* timer, int roadPositions[], int** positionType, int roadCount, int rows, int cols) {
-    // Wyczyść okna
-    wclear(playwin->window);
-    wclear(statwin->window);
-
+    batch.rounds = options->batch;
+    batch.roundTicks = options->roundTicks;
+    batch.seed = options->seed;
+    batch.input = input;
+    batch.results = new ROUND_RESULT[batch.configCount * batch.rounds];
+    batch.next = 0;
+
+    int threads = options->threads > 0 ? options->threads : int(std::thread::hardware_concurrency());
+    if (threads < 1) threads = 1;
+    double start = NowSeconds();
+    std::thread* workers = new std::thread[threads];
+    for (int t = 0; t < threads; t++) {
+        workers[t] = std::thread(BatchWorker, &batch);
+    }
+    for (int t = 0; t < threads; t++) {
+        workers[t].join();
+    }
+    delete[] workers;
+    double seconds = NowSeconds() - start;
 
-    // Rysowanie dróg i planszy
-    DrawMap(playwin, positionType, rows, cols);     // Draw map
+    FILE* out = (options->csv != NULL) ? fopen(options->csv, "w") : stdout;
+    if (out == NULL) {
+        cerr << "Cannot write " << options->csv << endl;
+    }
+    else {
+        WriteBatchCsv(out, &batch);
+        if (out != stdout) fclose(out);
+    }
+    cerr << batch.configCount * batch.rounds << " rounds on " << threads << " threads in " << seconds << " s" << endl;
 
-    UpdateStats(statwin, frog, timer);                    // Update stats
+    delete[] batch.results;
+    delete[] batch.configs;
+    return out != NULL ? EXIT_SUCCESS : EXIT_FAILURE;
+}
 
-    // Rysowanie żaby
-    DrawFrog(frog);              // Draw frog       
+//------------------------------------------------
+//---------------  BENCHMARK FUNCTIONS -----------
+//------------------------------------------------
 
-    wrefresh(playwin->window);
-    wrefresh(statwin->window);
+int RunGenerationBenchmark(OPTIONS* options) {
+    const int sizes[] = { 32, 100, 316, 1000, 3162 };       // About 1k to 10M cells
+    printf("%10s %12s %8s %12s %10s\n", "board", "cells", "roads", "ms", "ns/cell");
+    for (int i = 0; i < int(sizeof(sizes) / sizeof(sizes[0])); i++) {
+        int rows = sizes[i];
+        int cols = sizes[i];
+        int roads = rows - 5;                               // Crowded: two grass rows left, the worst case for redraws
+        ARENA arena;
+        InitArena(&arena);
+        MAP* map = InitMap(&arena, rows, cols);
+        int* roadPositions = ArenaArray<int>(&arena, roads);
+        RNG rng;
+        SeedRandom(&rng, options->seed);
+
+        int reps = 0;
+        double start = NowSeconds();
+        double seconds;
+        do {
+            InitParameters(&arena, &rng, roadPositions, map, rows, cols, roads);
+            reps++;
+            seconds = NowSeconds() - start;
+        } while (seconds < 0.2 || reps < 3);
+
+        double ms = seconds * 1e3 / reps;
+        char board[32];
+        snprintf(board, sizeof(board), "%dx%d", rows, cols);
+        printf("%10s %12lld %8d %12.3f %10.2f\n", board, (long long)rows * cols, roads, ms, ms * 1e6 / ((double)rows * cols));
+        fflush(stdout);
+        FreeArena(&arena);
+    }
+    return EXIT_SUCCESS;
 }
 
+#ifdef BENCH_SUITE
 //------------------------------------------------
-//------------  LOGIC OF THE GAME ----------------
+//---------------  BENCH SUITE -------------------
 //------------------------------------------------
 
+struct BENCH_CASE {
+    GAME game;                  // Headless round of the config
+    INPUT input;                // No script, the frog stays in place
+    ARENA arena;                // Round of the case
+    ARENA scratchArena;         // Scratch map, roads and queries
+    MAP* scratch;               // Rebuilt by InitParameters
+    int* scratchRoads;
+    RNG rng;
+    int* queryX;                // Cells the collision lookups ask about, all over the roads
+    int* queryY;
+    int queryCount;
+    WIN pad;                    // Off-screen window for DrawMap (window NULL without a terminal)
+    long long sink;             // Results are kept so the calls are not optimized away
+};
 
-bool CheckCollision(WIN* playwin, WIN* statwin, FROG* frog, STORK* stork, CAR cars[], TIMER* timer, int carsAndRoadsCount) {
-    if (CarColision(frog, cars, timer, carsAndRoadsCount) || StorkColision(frog, stork, timer)) {       // Check colisions with cars and stork
-        wclear(playwin->window);                                                                        // And print the game results
-        wclear(statwin->window);
-        mvwprintw(playwin->window, 1, 1, "You lose!");
-        mvwprintw(playwin->window, 3, 1, "Points: %d", frog->points);           // Print the game result
-        mvwprintw(playwin->window, 4, 1, "Time: %d", timer->time);
-        wrefresh(playwin->window);
-        wrefresh(statwin->window);
-        napms(5000);
-        return true;
+struct BENCH_RESULT {
+    const char* kernel;
+    CONFIG config;
+    double ns;                  // Per call
+    long long reps;             // Calls per sample
+};
+
+typedef void (*BENCH_KERNEL)(BENCH_CASE* bench, long long reps);
+
+void BenchMoveCars(BENCH_CASE* bench, long long reps) {
+    GAME* game = &bench->game;
+    for (long long r = 0; r < reps; r++) {
+        game->timer->carsTime--;                    // The cars' part of Timer
+        if (game->timer->carsTime <= 0) {
+            game->timer->carsTime = game->timer->carsTiming;
+        }
+        MoveCars(game->playwin, game->cars, &game->rng, game->timer, game->frog, game->occupancy, game->config.carLength,
+            game->config.carSpeed, CARM_COLOR, CARS_COLOR);
     }
-    return false;
 }
 
-
-void SaveHighScore(const char* filename, int score, int time) {
-    FILE* file = fopen(filename, "w");
-    if (file != NULL) {
-        fprintf(file, "%d %d", score, time);        // Save high score
-        fclose(file);
+void BenchCarColision(BENCH_CASE* bench, long long reps) {
+    FROG* frog = bench->game.frog;
+    int x = frog->x;
+    int y = frog->y;
+    int q = 0;
+    for (long long r = 0; r < reps; r++) {
+        frog->x = bench->queryX[q];
+        frog->y = bench->queryY[q];
+        bench->sink += CarColision(frog, bench->game.cars, bench->game.occupancy);
+        if (++q == bench->queryCount) q = 0;
     }
+    frog->x = x;
+    frog->y = y;
 }
 
-void LoadHighScore(const char* filename, int* score, int* time) {
-    FILE* file = fopen(filename, "r");
-    if (file != NULL) {
-        if (fscanf(file, "%d %d", score, time) != 2) {
-            *score = 0;
-            *time = 0;              // Load high score
-        }
-        fclose(file);
+void BenchFrogOnCar(BENCH_CASE* bench, long long reps) {
+    FROG* frog = bench->game.frog;
+    int x = frog->x;
+    int y = frog->y;
+    int q = 0;
+    for (long long r = 0; r < reps; r++) {
+        frog->x = bench->queryX[q];
+        frog->y = bench->queryY[q];
+        bench->sink += CheckIfFrogIsOnCar(frog, bench->game.occupancy);
+        if (++q == bench->queryCount) q = 0;
     }
-    else {
-        *score = 0;
-        *time = 0;
-    }
-}
-
-bool CheckWin(WIN* playwin, WIN* statwin, FROG* frog, TIMER* timer, int** positionType) {
-    if (frog->y == 1) {                 // Check if frog reached the destination
-        wclear(statwin->window);
-        wclear(playwin->window);
-        int highScore, bestTime;
-        LoadHighScore("highscore.txt", &highScore, &bestTime);      // Load high score from file
-        if (frog->points > highScore || (frog->points == highScore && timer->time < bestTime)) {
-            SaveHighScore("highscore.txt", frog->points, timer->time);          // Save new high score
-            mvwprintw(playwin->window, 2, 1, "New High Score!");
-        }
-        mvwprintw(playwin->window, 1, 1, "You win!");
-        mvwprintw(playwin->window, 3, 1, "Points: %d", frog->points);          // Print the game results
-        mvwprintw(playwin->window, 4, 1, "Time: %d", timer->time);
-        wrefresh(playwin->window);
-        wrefresh(statwin->window);
-        napms(5000);
-        return true;
+    frog->x = x;
+    frog->y = y;
+}
+
+void BenchInitParameters(BENCH_CASE* bench, long long reps) {
+    CONFIG* config = &bench->game.config;
+    for (long long r = 0; r < reps; r++) {
+        InitParameters(&bench->scratchArena, &bench->rng, bench->scratchRoads, bench->scratch, config->rows, config->cols, config->carsAndRoads);
     }
-    return false;
 }
 
+void BenchDrawMap(BENCH_CASE* bench, long long reps) {
+    for (long long r = 0; r < reps; r++) {
+        DrawMap(&bench->pad, bench->game.map, bench->game.config.rows, bench->game.config.cols);
+    }
+}
 
-//------------------------------------------------
-//---------  GAME PARAMETERS FUNCTIONS -----------
-//------------------------------------------------
+void BenchTick(BENCH_CASE* bench, long long reps) {
+    for (long long r = 0; r < reps; r++) {
+        StepGame(&bench->game, &bench->input);
+    }
+}
 
-void LoadConfig(const char* filename, int* rows, int* cols, int* carAndRoads, char* frogSign, char* carSign, int* carSpeed, int* carLength) {
-    FILE* file = fopen(filename, "r");
-    if (file != NULL) {
-        if (fscanf(file, "ROWS: %d\n COLS: %d\n CAR_AND_ROADS: %d\n FROG_SIGN: %c\n CAR_SIGN: %c\n CAR_SPEED: %d\n CAR_LENGTH: %d",     // Load game parameters from file
-            rows, cols, carAndRoads, frogSign, carSign, carSpeed, carLength) != 7) {
-            *rows = 20;
-            *cols = 30;
-            *carAndRoads = 9;
-            *frogSign = '@';
-            *carSign = '#';
-            *carSpeed = 3;                                  // If file is empty or parameters are incorrect,
-            *carLength = 3;                                 // set default values
+const char* BENCH_NAMES[] = { "move_cars", "car_collision", "frog_on_car", "init_parameters", "draw_map", "tick" };
+const BENCH_KERNEL BENCH_KERNELS[] = { BenchMoveCars, BenchCarColision, BenchFrogOnCar, BenchInitParameters, BenchDrawMap, BenchTick };
+#define BENCH_KERNEL_COUNT 6
+
+void InitBenchCase(BENCH_CASE* bench, CONFIG* config, unsigned long long seed, bool terminal) {
+    bench->game.config = *config;
+    bench->game.seed = seed;
+    bench->game.profiler = NULL;
+    bench->game.spectator = NULL;
+    InitArena(&bench->arena);
+    InitArena(&bench->scratchArena);
+    bench->game.arena = &bench->arena;
+    InitRound(&bench->game, NULL);
+    InitKeyboardInput(&bench->input);
+    bench->scratch = InitMap(&bench->scratchArena, config->rows, config->cols);
+    bench->scratchRoads = ArenaArray<int>(&bench->scratchArena, config->carsAndRoads);
+    SeedRandom(&bench->rng, seed);
+
+    bench->queryX = ArenaArray<int>(&bench->scratchArena, config->carsAndRoads * (config->cols - 2) + 1);
+    bench->queryY = ArenaArray<int>(&bench->scratchArena, config->carsAndRoads * (config->cols - 2) + 1);
+    bench->queryCount = 0;
+    for (int i = 0; i < config->carsAndRoads; i++) {
+        for (int x = 1; x < config->cols - 1; x++) {
+            bench->queryX[bench->queryCount] = x;                   // Every road cell, in order
+            bench->queryY[bench->queryCount++] = bench->game.roadPositions[i];
         }
     }
-    else {
-        *rows = 20;
-        *cols = 30;
-        *carAndRoads = 9;
-        *frogSign = '@';
-        *carSign = '#';
-        *carSpeed = 3;
-        *carLength = 3;
+    if (bench->queryCount == 0) {
+        bench->queryX[0] = bench->game.frog->x;
+        bench->queryY[0] = bench->game.frog->y;
+        bench->queryCount = 1;
     }
-}
 
-void InitParameters(int roadPositions[], int** positionType, int rows, int cols, int roads) {
+    bench->pad = *bench->game.playwin;
+    bench->pad.window = terminal ? newpad(config->rows, config->cols) : NULL;      // Drawn into, never shown
+    bench->pad.renderer = terminal ? FindRenderer("curses") : NULL_RENDERER;
+    bench->sink = 0;
+}
 
-    for (int i = 0; i < rows; i++) {            // Set grass positions
-        for (int j = 0; j < cols; j++) {
-            positionType[i][j] = GRASS;
-        }
+void FreeBenchCase(BENCH_CASE* bench) {
+    if (bench->pad.window != NULL) {
+        delwin(bench->pad.window);
     }
+    FreeInput(&bench->input);
+    CleanupRound(&bench->game);
+    FreeArena(&bench->arena);
+    FreeArena(&bench->scratchArena);
+}
 
-    for (int j = 0; j < cols; ++j) {                     // Set destination position    
-        positionType[1][j] = DESTINATION;
+double MeasureKernel(BENCH_KERNEL kernel, BENCH_CASE* bench, long long* reps) {
+    *reps = 1;
+    while (true) {                                  // Double the calls per sample until a sample is long enough
+        long long start = MonotonicNs();
+        kernel(bench, *reps);
+        if (MonotonicNs() - start >= BENCH_SAMPLE_NS) break;
+        *reps *= 2;
     }
+    double samples[BENCH_SAMPLES];
+    for (int s = 0; s < BENCH_SAMPLES; s++) {
+        long long start = MonotonicNs();
+        kernel(bench, *reps);
+        samples[s] = double(MonotonicNs() - start) / *reps;
+    }
+    sort(samples, samples + BENCH_SAMPLES);
+    return samples[BENCH_SAMPLES / 2];             // Median, so one preempted sample does not move the figure
+}
 
-
-    bool* usedRows = new bool[rows];            // Used rows
-    for (int i = 0; i < rows; i++) {
-        usedRows[i] = false;
+void WriteBenchJson(FILE* out, BENCH_RESULT* results, int count, unsigned long long seed) {
+    fprintf(out, "{\n  \"seed\": %llu,\n  \"car_kernels\": \"%s\",\n  \"results\": [\n", seed, carKernels.name);
+    for (int i = 0; i < count; i++) {               // One result per line, so --baseline reads it back with sscanf
+        BENCH_RESULT* result = &results[i];
+        fprintf(out, "    {\"kernel\": \"%s\", \"rows\": %d, \"cols\": %d, \"roads\": %d, \"car_length\": %d, \"ns\": %.2f, \"reps\": %lld}%s\n",
+            result->kernel, result->config.rows, result->config.cols, result->config.carsAndRoads, result->config.carLength,
+            result->ns, result->reps, i + 1 < count ? "," : "");
     }
+    fprintf(out, "  ]\n}\n");
+}
 
-    int roadsCreated = 0;
-    while (roadsCreated < roads) {                  // Set road positions
-        int roadY = rand() % (rows - 4) + 2;
-        if (!usedRows[roadY]) {
-            usedRows[roadY] = true;
-            roadPositions[roadsCreated] = roadY;
-            for (int j = 0; j < cols; ++j) {
-                positionType[roadY][j] = ROAD;
+int CompareBench(const char* filename, BENCH_RESULT* results, int count, int threshold) {
+    FILE* file = fopen(filename, "r");
+    if (file == NULL) {
+        cerr << "Cannot read baseline " << filename << endl;
+        return -1;
+    }
+    int regressions = 0;
+    fprintf(stderr, "%-16s %5s %5s %5s %4s %12s %12s %8s\n", "kernel", "rows", "cols", "roads", "len", "baseline ns", "ns", "change");
+    char line[256];
+    while (fgets(line, sizeof(line), file) != NULL) {
+        char kernel[32];
+        CONFIG base;
+        double ns;
+        if (sscanf(line, " {\"kernel\": \"%31[^\"]\", \"rows\": %d, \"cols\": %d, \"roads\": %d, \"car_length\": %d, \"ns\": %lf",
+            kernel, &base.rows, &base.cols, &base.carsAndRoads, &base.carLength, &ns) != 6) {
+            continue;
+        }
+        for (int i = 0; i < count; i++) {
+            BENCH_RESULT* result = &results[i];
+            if (strcmp(result->kernel, kernel) != 0 || result->config.rows != base.rows || result->config.cols != base.cols
+                || result->config.carsAndRoads != base.carsAndRoads || result->config.carLength != base.carLength) {
+                continue;
             }
-            roadsCreated++;
+            double change = (ns > 0) ? (result->ns - ns) * 100 / ns : 0;
+            bool regression = change > threshold;
+            regressions += regression;
+            fprintf(stderr, "%-16s %5d %5d %5d %4d %12.2f %12.2f %+7.1f%%%s\n", kernel, base.rows, base.cols, base.carsAndRoads,
+                base.carLength, ns, result->ns, change, regression ? " REGRESSION" : "");
         }
     }
-    delete[] usedRows;
+    fclose(file);
+    return regressions;
+}
+
+int RunBenchSuite(OPTIONS* options, CONFIG* config) {
+    CONFIG* configs;
+    int configCount = BuildSweep(options, config, &configs);
+    if (configCount == 0) {
+        cerr << "Bad --sweep, expected name=v1,v2,... with name rows, cols, roads, car-speed, car-length, stork, moves, storks or cars-per-lane" << endl;
+        return EXIT_FAILURE;
+    }
 
+    FILE* devnull = fopen("/dev/null", "r+");
+    SCREEN* screen = (devnull != NULL) ? newterm(getenv("TERM") != NULL ? getenv("TERM") : "xterm", devnull, devnull) : NULL;     // Curses without a terminal
+    if (screen == NULL) {
+        cerr << "No curses terminal, draw_map is skipped" << endl;
+    }
 
-    int obstaclesPlaced = 0;
-    while (obstaclesPlaced < OBSTACLE_COUNT) {           // Set obstacles positions  
-        int obstacleY = rand() % (rows - 2) + 1;
-        int obstacleX = rand() % (cols - 2) + 1;
-        if (positionType[obstacleY][obstacleX] == GRASS) {      // Obstacles must be on grass
-            positionType[obstacleY][obstacleX] = OBSTACLE;
-            obstaclesPlaced++;
+    BENCH_RESULT* results = new BENCH_RESULT[configCount * BENCH_KERNEL_COUNT];
+    int count = 0;
+    for (int c = 0; c < configCount; c++) {
+        const char* configError = CheckConfig(&configs[c]);
+        if (configError != NULL) {
+            fprintf(stderr, "Skipping %dx%d, %d roads, car length %d: %s\n", configs[c].rows, configs[c].cols,
+                configs[c].carsAndRoads, configs[c].carLength, configError);
+            continue;
+        }
+        for (int k = 0; k < BENCH_KERNEL_COUNT; k++) {
+            if (BENCH_KERNELS[k] == BenchDrawMap && screen == NULL) {
+                continue;
+            }
+            BENCH_CASE bench;
+            InitBenchCase(&bench, &configs[c], options->seed, screen != NULL);      // A fresh round for every kernel
+            BENCH_RESULT* result = &results[count++];
+            result->kernel = BENCH_NAMES[k];
+            result->config = configs[c];
+            result->ns = MeasureKernel(BENCH_KERNELS[k], &bench, &result->reps);
+            fprintf(stderr, "%-16s %4dx%-4d %3d roads, length %2d: %10.2f ns\n", result->kernel, configs[c].rows, configs[c].cols,
+                configs[c].carsAndRoads, configs[c].carLength, result->ns);
+            FreeBenchCase(&bench);
         }
     }
+    if (screen != NULL) {
+        endwin();
+        delscreen(screen);
+    }
+    if (devnull != NULL) {
+        fclose(devnull);
+    }
 
-    int coinsPlaced = 0;
-    while (coinsPlaced < COINS_COUNT) {       // Set coins positions
-        int coinY = rand() % (rows - 2) + 1;
-        int coinX = rand() % (cols - 2) + 1;
-        if (positionType[coinY][coinX] == GRASS && positionType[coinY][coinX] != OBSTACLE) {       // Coins must be on grass and 
-            positionType[coinY][coinX] = COIN;                                                                                           // can't be on obstacles   
-            coinsPlaced++;
+    int exitCode = EXIT_SUCCESS;
+    FILE* out = (options->json != NULL) ? fopen(options->json, "w") : stdout;
+    if (out == NULL) {
+        cerr << "Cannot write " << options->json << endl;
+        exitCode = EXIT_FAILURE;
+    }
+    else {
+        WriteBenchJson(out, results, count, options->seed);
+        if (out != stdout) fclose(out);
+    }
+    if (options->baseline != NULL) {
+        int regressions = CompareBench(options->baseline, results, count, options->threshold);
+        if (regressions != 0) {
+            if (regressions > 0) cerr << regressions << " regressions over " << options->threshold << "%" << endl;
+            exitCode = EXIT_FAILURE;
         }
     }
 
+    delete[] results;
+    delete[] configs;
+    return exitCode;
 }
 
-void InitializeGame(WINDOW*& mainwin, WIN*& playwin, WIN*& statwin, FROG*& frog, STORK*& stork,
-    TIMER*& timer, CAR*& cars, int**& positionType, int*& roadPositions, int& ROWS, int& COLS, int& MAX_CARS_ROADS,
-    int& CAR_SPEED, int& CAR_LENGTH, char& FROG_SIGN, char& CAR_SIGN) {
-    mainwin = Start();      // Setup main window         
-    Welcome(mainwin);    // Welcome screen (menu)
+#endif
 
-    LoadConfig("config.txt", &ROWS, &COLS, &MAX_CARS_ROADS, &FROG_SIGN, &CAR_SIGN, &CAR_SPEED, &CAR_LENGTH);        // Loading game parameters from file
-
-    cars = new CAR[MAX_CARS_ROADS];              // Init amount of cars
+//------------------------------------------------
+//----------------  MAIN FUNCTION ----------------
+//------------------------------------------------
 
-    positionType = new int* [ROWS];             // Init game map positions
-    for (int i = 0; i < ROWS; i++) {
-        positionType[i] = new int[COLS];
+bool ParseOptions(int argc, char* argv[], OPTIONS* options) {
+    options->headless = false;
+    options->ticks = 1000000;
+    options->rounds = 0;
+    options->seeded = false;
+    options->seed = 0;
+    options->script = NULL;
+    options->config = "config.txt";
+    options->record = NULL;
+    options->replay = NULL;
+    options->endless = false;
+    options->benchGeneration = false;
+    options->batch = 0;
+    options->threads = 0;
+    options->policy = NULL;
+    options->csv = NULL;
+    options->sweepCount = 0;
+    options->roundTicks = BATCH_ROUND_TICKS;
+    options->autopilot = false;
+    options->inputBuffer = INPUT_BUFFER;
+    options->profile = NULL;
+    options->profileOverlay = false;
+    options->json = NULL;
+    options->baseline = NULL;
+    options->threshold = BENCH_THRESHOLD;
+    options->kernels = NULL;
+    options->checkKernels = 0;
+    options->renderer = "curses";
+    options->maxFps = 0;
+    options->spectate = NULL;
+    options->watch = NULL;
+    options->practice = false;
+    options->saveState = NULL;
+    options->loadState = NULL;
+    options->state = NULL;
+    options->checkState = 0;
+
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "--headless") == 0) options->headless = true;
+        else if (strcmp(argv[i], "--endless") == 0) options->endless = true;
+        else if (strcmp(argv[i], "--bench-generation") == 0) options->benchGeneration = true;
+        else if (strcmp(argv[i], "--autopilot") == 0) options->autopilot = true;
+        else if (strcmp(argv[i], "--profile-overlay") == 0) options->profileOverlay = true;
+        else if (strcmp(argv[i], "--profile") == 0 && hasValue) options->profile = argv[++i];
+        else if (strcmp(argv[i], "--ticks") == 0 && hasValue) options->ticks = atoll(argv[++i]);
+        else if (strcmp(argv[i], "--rounds") == 0 && hasValue) options->rounds = atoll(argv[++i]);
+        else if (strcmp(argv[i], "--seed") == 0 && hasValue) {
+            options->seed = strtoull(argv[++i], NULL, 10);
+            options->seeded = true;
+        }
+        else if (strcmp(argv[i], "--script") == 0 && hasValue) options->script = argv[++i];
+        else if (strcmp(argv[i], "--config") == 0 && hasValue) options->config = argv[++i];
+        else if (strcmp(argv[i], "--record") == 0 && hasValue) options->record = argv[++i];
+        else if (strcmp(argv[i], "--replay") == 0 && hasValue) options->replay = argv[++i];
+        else if (strcmp(argv[i], "--batch") == 0 && hasValue) options->batch = atoll(argv[++i]);
+        else if (strcmp(argv[i], "--threads") == 0 && hasValue) options->threads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--policy") == 0 && hasValue) options->policy = argv[++i];
+        else if (strcmp(argv[i], "--csv") == 0 && hasValue) options->csv = argv[++i];
+        else if (strcmp(argv[i], "--json") == 0 && hasValue) options->json = argv[++i];
+        else if (strcmp(argv[i], "--baseline") == 0 && hasValue) options->baseline = argv[++i];
+        else if (strcmp(argv[i], "--threshold") == 0 && hasValue) options->threshold = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--kernels") == 0 && hasValue) options->kernels = argv[++i];
+        else if (strcmp(argv[i], "--check-kernels") == 0 && hasValue) options->checkKernels = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--renderer") == 0 && hasValue) options->renderer = argv[++i];
+        else if (strcmp(argv[i], "--max-fps") == 0 && hasValue) options->maxFps = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--spectate") == 0 && hasValue) options->spectate = argv[++i];
+        else if (strcmp(argv[i], "--watch") == 0 && hasValue) options->watch = argv[++i];
+        else if (strcmp(argv[i], "--practice") == 0) options->practice = true;
+        else if (strcmp(argv[i], "--save-state") == 0 && hasValue) options->saveState = argv[++i];
+        else if (strcmp(argv[i], "--load-state") == 0 && hasValue) options->loadState = argv[++i];
+        else if (strcmp(argv[i], "--check-state") == 0 && hasValue) options->checkState = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--input-buffer") == 0 && hasValue) options->inputBuffer = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--round-ticks") == 0 && hasValue) options->roundTicks = atoll(argv[++i]);
+        else if (strcmp(argv[i], "--sweep") == 0 && hasValue && options->sweepCount < BATCH_MAX_SWEEPS) options->sweeps[options->sweepCount++] = argv[++i];
+        else {
+            cerr << "Unknown option " << argv[i] << endl;
+            return false;
+        }
     }
-
-    roadPositions = new int[MAX_CARS_ROADS];    // Init road positions
-
-    InitParameters(roadPositions, positionType, ROWS, COLS, MAX_CARS_ROADS);        // Init game map (randomize positions on the map)
-
-    playwin = Init(mainwin, ROWS, COLS, Y, X, MAIN_COLOR);                                      // Init subwindow for the game
-    statwin = Init(mainwin, STATS_HEIGHT, STATS_WIDTH, Y, COLS + 1 + X, MAIN_COLOR);    // Init subwindow for the stats
-
-    stork = InitStork(playwin, STORK_COLOR, STORK_SIGN, TIME_TO_STORK);                     // Init stork parameters
-    frog = InitFrog(playwin, FROG_COLOR, FROG_SIGN, FROG_REMAINING_MOVES, positionType);    // Init frog parameters
-
-
-    timer = InitTimer(statwin, START_TIME, FRAME_RATE, MAX_FRAME_RATE, CHECK_FRAME_RATE, CAR_SPEED * CAR_SPEED);    // Init timer parameters
-
-    InitCars(playwin, cars, roadPositions, MAX_CARS_ROADS, CAR_LENGTH, CAR_SPEED, CARM_COLOR, CARS_COLOR, CAR_SIGN);    // Init cars parameters
-    DrawGame(playwin, statwin, frog, timer, roadPositions, positionType, MAX_CARS_ROADS, ROWS, COLS);           // Draw map and game elements
+    return true;
 }
 
-void CleanupGame(WINDOW* mainwin, WIN* playwin, WIN* statwin, FROG* frog, STORK* stork, TIMER* timer, CAR* cars, int** positionType, int* roadPositions, int ROWS) {
-    for (int i = 0; i < ROWS; i++) {
-        delete[] positionType[i];
+#ifdef BENCH_SUITE
+int main(int argc, char* argv[]) {
+    OPTIONS options;
+    if (!ParseOptions(argc, argv, &options)) {
+        return EXIT_FAILURE;
     }
-    delete[] positionType;
-    delete[] roadPositions;             // Cleanup all game parameters
-    delete[] cars;
-    delete frog;
-    delete stork;
-    delete timer;
-    delwin(playwin->window);
-    delwin(statwin->window);
-    delwin(mainwin);
-    endwin();
+    if (!SelectCarKernels(options.kernels)) {
+        cerr << "Car kernels " << options.kernels << " not available" << endl;
+        return EXIT_FAILURE;
+    }
+    if (!options.seeded) {
+        options.seed = BENCH_SEED;
+    }
+    if (options.sweepCount == 0) {
+        options.sweeps[options.sweepCount++] = "rows=20,100,400";       // Board size, lanes and car length
+        options.sweeps[options.sweepCount++] = "cols=30,400";
+        options.sweeps[options.sweepCount++] = "roads=5,15";
+        options.sweeps[options.sweepCount++] = "car-length=3,10";
+    }
+
+    CONFIG config;
+    LoadConfig(options.config, &config);
+    config.endless = false;
+    return RunBenchSuite(&options, &config);
 }
+#else
+int main(int argc, char* argv[]) {
+    OPTIONS options;
+    if (!ParseOptions(argc, argv, &options)) {
+        return EXIT_FAILURE;
+    }
+    if (!SelectCarKernels(options.kernels)) {
+        cerr << "Car kernels " << options.kernels << " not available" << endl;
+        return EXIT_FAILURE;
+    }
+    if (!options.seeded) {
+        options.seed = (unsigned long long)time(NULL);          // Still printed, so the round can be replayed
+    }
+    if (options.benchGeneration) {
+        return RunGenerationBenchmark(&options);
+    }
+    if (options.watch != NULL) {
+        return RunWatch(&options);
+    }
 
-//------------------------------------------------
-//----------------  MainLoop FUNCTION ------------
-//------------------------------------------------
+    CONFIG config;
+    INPUT input;
+    InitKeyboardInput(&input);
+    input.bufferSize = max(0, min(options.inputBuffer, INPUT_MAX_BUFFER));
+    if (options.replay != NULL) {
+        if (!LoadReplay(options.replay, &input, &options.seed, &config)) {       // Seed and config come from the replay
+            cerr << "Cannot read replay " << options.replay << endl;
+            return EXIT_FAILURE;
+        }
+        options.rounds = 1;
+        options.record = NULL;
+    }
+    else if (options.loadState != NULL) {
+        options.state = ReadStateFile(options.loadState, &config, &options.seed);     // Seed and config come from the state
+        if (options.state == NULL || !options.headless) {
+            cerr << (options.state == NULL ? "Cannot read state " : "--load-state needs --headless: ") << options.loadState << endl;
+            return EXIT_FAILURE;
+        }
+        options.rounds = 1;
+        options.record = NULL;                      // A replay starts at tick 0
+        if (options.script != NULL && !LoadScript(options.script, &input)) {
+            cerr << "Cannot open script " << options.script << endl;
+            return EXIT_FAILURE;
+        }
+    }
+    else {
+        LoadConfig(options.config, &config);        // Loading game parameters from file
+        config.endless = options.endless;
+        if (options.script != NULL && !LoadScript(options.script, &input)) {
+            cerr << "Cannot open script " << options.script << endl;
+            return EXIT_FAILURE;
+        }
+    }
 
-void MainLoop(WIN* statwin, WIN* playwin, FROG* frog, STORK* stork, int** positionType, CAR cars[], TIMER* timer, int carsAndRoadsCount,
-    int carLenght, int carSpeed, int carMoveColor, int carStopColor, int carFrogColor) {
-    keypad(playwin->window, TRUE);      // Can use arrows
-    nodelay(playwin->window, TRUE);
-    while (!CheckCollision(playwin, statwin, frog, stork, cars, timer, carsAndRoadsCount) &&
-        !CheckWin(playwin, statwin, frog, timer, positionType)) {           // Check coliisions and win conditions
+    const char* configError = CheckConfig(&config);
+    if (configError != NULL) {
+        cerr << "Invalid config: " << configError << endl;          // Generation could never place everything
+        FreeInput(&input);
+        return EXIT_FAILURE;
+    }
 
-        UpdateStats(statwin, frog, timer);         // Update stats
+    if (options.batch > 0) {
+        int result = RunBatch(&options, &input, &config);
+        FreeInput(&input);
+        return result;
+    }
 
-        FrogMovement(playwin, frog, cars, carsAndRoadsCount, positionType, carStopColor, carFrogColor);  // Move frog
+    if (options.checkKernels > 0) {
+        int result = RunKernelCheck(&options, &input, &config);
+        FreeInput(&input);
+        return result;
+    }
 
-        MoveCars(cars, timer, frog, positionType, carsAndRoadsCount, carLenght, carSpeed, carMoveColor, carStopColor);      // Move cars
+    if (options.checkState > 0) {
+        int result = RunStateCheck(&options, &input, &config);
+        FreeInput(&input);
+        return result;
+    }
 
-        MoveStork(stork, frog, timer, positionType);    // Move strok
+    if (options.autopilot && options.headless) {
+        FreeInput(&input);
+        return RunAutopilot(&options, &config);
+    }
 
-        napms(timer->frameRate);                // Delay of the refresh rate
+    if (options.headless) {
+        int result = RunHeadless(&options, &input, &config);
+        FreeInput(&input);
+        delete[] options.state;
+        return result;
+    }
+    if (options.practice && options.record != NULL) {
+        cerr << "--practice rounds cannot be recorded (a rewind would not replay)" << endl;
+        FreeInput(&input);
+        return EXIT_FAILURE;
+    }
 
+    RENDERER* renderer = FindRenderer(options.renderer);
+    if (renderer == NULL || !renderer->draws) {
+        cerr << "Unknown renderer " << options.renderer << " (curses or ansi)" << endl;      // null is for headless runs
+        FreeInput(&input);
+        return EXIT_FAILURE;
+    }
+    renderer->frameNs = (options.maxFps > 0) ? 1000000000LL / options.maxFps : 0;
+    if (!renderer->start(renderer)) {                   // One terminal session for every round
+        cerr << "Cannot start the " << renderer->name << " renderer on this terminal" << endl;
+        FreeInput(&input);
+        return EXIT_FAILURE;
     }
 
-    return;
-}
+    GAME game;
+    game.config = config;
+    game.profiler = (options.profile != NULL || options.profileOverlay) ? InitProfiler(options.profileOverlay, options.profile) : NULL;
+    game.leaderboard = options.practice ? NULL : OpenLeaderboard(LEADERBOARD_FILE);          // Loaded once, written on its own thread (practice rounds don't count)
+    game.spectator = (options.spectate != NULL) ? OpenSpectator(options.spectate) : NULL;
 
-//------------------------------------------------
-//----------------  MAIN FUNCTION ----------------
-//------------------------------------------------
+    ARENA arenas[2];                // Round n in arena n % 2, the next round is built while the last one still shows
+    ARENA session;                  // Windows kept for the whole session
+    InitArena(&arenas[0]);
+    InitArena(&arenas[1]);
+    InitArena(&session);
 
-int main() {
-    srand(time(NULL));
+    REWIND rewind;                  // Practice mode only, reused every round
+    InitRewind(&rewind);
 
-    WINDOW* mainwin;
-    WIN* playwin;
-    WIN* statwin;
-    FROG* frog;
-    STORK* stork;
-    TIMER* timer;
-    CAR* cars;
-    int** positionType;
-    int* roadPositions;
-    int ROWS, COLS, MAX_CARS_ROADS, CAR_SPEED, CAR_LENGTH;
-    char FROG_SIGN, CAR_SIGN;
+    NEXT_ROUND next;
+    StartNextRound(&next, &config, options.seed, &options, &arenas[0]);        // The first round is built while the menu shows
 
-    while (true) {
-        InitializeGame(mainwin, playwin, statwin, frog, stork, timer, cars, positionType,               // Init game parameters
-            roadPositions, ROWS, COLS, MAX_CARS_ROADS, CAR_SPEED, CAR_LENGTH, FROG_SIGN, CAR_SIGN);
+    WIN* menu = Init(&session, renderer, renderer->rows, renderer->cols, 0, 0, 0);      // Whole terminal, its own colors
+    Welcome(menu);    // Welcome screen (menu)
+    renderer->close(menu);
+    WIN* playwin = Init(&session, renderer, config.rows, config.cols, Y, X, MAIN_COLOR);
+    WIN* statwin = Init(&session, renderer, StatsHeight(&game), STATS_WIDTH, Y, config.cols + 1 + X, MAIN_COLOR);
 
-        MainLoop(statwin, playwin, frog, stork, positionType, cars, timer, MAX_CARS_ROADS, CAR_LENGTH,      // Main game loop
-            CAR_SPEED, CARM_COLOR, CARS_COLOR, CARC_COLOR);
+    for (long long round = 0; ; round++) {
+        FinishNextRound(&next);
+        StartRound(&game, &next, playwin, statwin, &input);
+
+        if (options.record != NULL) {
+            StartRecording(&input, options.record, game.seed, &game.config);      // Keeps the last round
+        }
+        MainLoop(&game, &input, options.practice ? &rewind : NULL);      // Main game loop
+        StopRecording(&input);
 
-        CleanupGame(mainwin, playwin, statwin, frog, stork, timer, cars, positionType, roadPositions, ROWS);                             // Cleanup game parameters
+        bool last = options.rounds != 0 && round + 1 >= options.rounds;
+        if (!last) {
+            StartNextRound(&next, &config, options.seed + round + 1, &options, &arenas[(round + 1) % 2]);    // Built during the result screen
+        }
+        bool again = PlayAgain(playwin, !last);
+        EndRound(&game);
+        if (!again) {
+            if (!last) {
+                DropNextRound(&next);
+            }
+            break;
+        }
     }
 
+    renderer->close(playwin);
+    renderer->close(statwin);
+    FreeArena(&session);
+    FreeArena(&arenas[0]);
+    FreeArena(&arenas[1]);
+    renderer->end(renderer);
+    if (game.spectator != NULL) {
+        CloseSpectator(game.spectator);
+    }
+    if (game.leaderboard != NULL) {
+        CloseLeaderboard(game.leaderboard);
+    }
+    FreeRewind(&rewind);
+    delete game.profiler;
+    int desyncTick = input.desyncTick;
+    FreeInput(&input);
+    if (desyncTick >= 0) {
+        cerr << "Replay played differently from tick " << desyncTick << " on (another build, or a bug)" << endl;     // Once the terminal is back
+        return EXIT_FAILURE;
+    }
     return 0;
-}
\ No newline at end of file
+}
+#endif